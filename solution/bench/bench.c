@@ -0,0 +1,312 @@
+// bench: time every regex_tool mode over generated inputs of growing size
+//
+// Usage: bench [--tool PATH] [--gen PATH] [--sizes "10 100 ..."]
+//              [--budget NODES] [--modes name,name,...] [--timeout SEC]
+//              [--max-output MB] [--seed S] [--tmp DIR]
+//
+// For each size n, regex_gen writes max(1, budget / n) lines of n nodes,
+// so every size costs about the same total work.  Each mode then runs
+// once as a child process with that file on stdin (--load gets the
+// strings, matched against automata compiled from it).  One JSON object per
+// (mode, size) goes to stdout:
+//
+//   {"mode":"--prefixes","size":1000,"lines":2000,"nodes":1999000,
+//    "wall_ms":..,"cpu_ms":..,"ns_per_node":..,"out_bytes":..,
+//    "max_rss_kb":..,"status":"ok"}
+//
+// Wall time comes from CLOCK_MONOTONIC; CPU time and peak RSS from
+// wait4().  A child that uses more than --timeout seconds of CPU is
+// stopped by RLIMIT_CPU ("timeout"), and one whose output passes
+// --max-output by RLIMIT_FSIZE ("output-limit"), so a mode that blows
+// up on large inputs is reported instead of filling the disk.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MAX_ARGS 8
+
+typedef struct Mode {
+    const char* name;                   // what --modes selects on
+    const char* args[MAX_ARGS];         // after the tool path; "@S" = strings file,
+                                        // "@D" = compiled-automaton path,
+                                        // "@I" = the generated regexes
+} Mode;
+
+static const Mode MODES[] = {
+    { "no-op",          { "--no-op" } },
+    { "simplify",       { "--simplify" } },
+    { "canonical",      { "--canonical" } },
+    { "empty",          { "--empty" } },
+    { "has-epsilon",    { "--has-epsilon" } },
+    { "has-nonepsilon", { "--has-nonepsilon" } },
+    { "uses",           { "--uses", "a" } },
+    { "not-using",      { "--not-using", "a" } },
+    { "infinite",       { "--infinite" } },
+    { "starts-with",    { "--starts-with", "a" } },
+    { "ends-with",      { "--ends-with", "a" } },
+    { "reverse",        { "--reverse" } },
+    { "prefixes",       { "--prefixes" } },
+    { "bs-for-a",       { "--bs-for-a" } },
+    { "insert",         { "--insert", "a" } },
+    { "insert-compact", { "--insert", "a", "--compact" } },
+    { "strip",          { "--strip", "a" } },
+    { "queries",        { "--queries", "empty,has-epsilon,has-nonepsilon,infinite,"
+                                       "uses=a,starts-with=a,ends-with=a" } },
+    { "match",          { "--match", "@S" } },
+    { "match-glushkov", { "--match", "@S", "--engine=glushkov" } },
+    { "strip-word",     { "--strip-word", "ab" } },
+    { "right-strip-word", { "--right-strip-word", "ab" } },
+    { "left-quotient",  { "--left-quotient", "a*b." } },
+    { "right-quotient", { "--right-quotient", "a*b." } },
+    { "equivalent",     { "--equivalent" } },
+    { "compile",        { "--compile", "@D" } },
+    { "load",           { "--load", "@D" } },
+    { "scan",           { "--scan", "@I", "@S" } },
+    { "count",          { "--count", "10" } },
+    { "cardinality",    { "--cardinality" } },
+    { "enumerate",      { "--enumerate", "100" } },
+    { "enumerate-upto", { "--enumerate-upto", "5" } },
+    { "alphabet",       { "--alphabet" } },
+    { "starts-with-set", { "--starts-with-set" } },
+    { "ends-with-set",  { "--ends-with-set" } },
+};
+#define NMODES (sizeof MODES / sizeof MODES[0])
+
+typedef struct Result {
+    double wall_ms, cpu_ms;
+    long   max_rss_kb;
+    long long out_bytes;
+    char   status[32];
+} Result;
+
+static const char* tool_path = "./regex_tool";
+static const char* gen_path  = "./regex_gen";
+static const char* tmp_dir   = NULL;
+static unsigned long long seed = 1;
+static unsigned timeout_sec = 60;
+static unsigned long max_output_mb = 512;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long long file_size(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : 0;
+}
+
+// Run argv with stdin from in_path (or /dev/null) and stdout to out_path,
+// under the CPU and file-size limits, and fill in r.
+static int run(char* const argv[], const char* in_path, const char* out_path, Result* r) {
+    int in  = open(in_path ? in_path : "/dev/null", O_RDONLY);
+    int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in < 0 || out < 0) {
+        fprintf(stderr, "Error: cannot open %s\n", in < 0 ? in_path : out_path);
+        return 0;
+    }
+    double t0 = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); return 0; }
+    if (pid == 0) {
+        struct rlimit cpu = { timeout_sec, timeout_sec + 1 };
+        struct rlimit fsz = { (rlim_t)max_output_mb << 20, (rlim_t)max_output_mb << 20 };
+        setrlimit(RLIMIT_CPU, &cpu);
+        setrlimit(RLIMIT_FSIZE, &fsz);
+        dup2(in, 0);
+        dup2(out, 1);
+        close(in);
+        close(out);
+        execv(argv[0], argv);
+        fprintf(stderr, "Error: cannot run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(in);
+    close(out);
+
+    int wstatus;
+    struct rusage ru;
+    while (wait4(pid, &wstatus, 0, &ru) < 0)
+        if (errno != EINTR) { perror("wait4"); return 0; }
+    r->wall_ms = now_ms() - t0;
+    r->cpu_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3
+              + ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+    r->max_rss_kb = ru.ru_maxrss;
+    r->out_bytes = file_size(out_path);
+    if (WIFEXITED(wstatus)) {
+        if (WEXITSTATUS(wstatus) == 0) strcpy(r->status, "ok");
+        else snprintf(r->status, sizeof r->status, "exit %d", WEXITSTATUS(wstatus));
+    } else {
+        int sig = WTERMSIG(wstatus);
+        if (sig == SIGXCPU || (sig == SIGKILL && r->cpu_ms >= timeout_sec * 1e3))
+            strcpy(r->status, "timeout");
+        else if (sig == SIGXFSZ)
+            strcpy(r->status, "output-limit");
+        else
+            snprintf(r->status, sizeof r->status, "signal %d", sig);
+    }
+    return 1;
+}
+
+// The --match strings: 1000 words of length 0..24 over {a, b, c}.
+static int write_strings(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return 0;
+    uint64_t s = seed ^ 0x5DEECE66DULL;
+    for (int i = 0; i < 1000; i++) {
+        s = s * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned len = (unsigned)(s >> 33) % 25;
+        for (unsigned j = 0; j < len; j++) {
+            s = s * 6364136223846793005ULL + 1442695040888963407ULL;
+            fputc("abc"[(s >> 33) % 3], f);
+        }
+        fputc('\n', f);
+    }
+    return fclose(f) == 0;
+}
+
+static int is_mode(const Mode* m, const char* option) {
+    return strcmp(m->args[0], option) == 0;
+}
+
+static int selected(const char* list, const char* name) {
+    if (!list) return 1;
+    size_t n = strlen(name);
+    for (const char* p = list; *p; ) {
+        size_t k = strcspn(p, ",");
+        if (k == n && strncmp(p, name, n) == 0) return 1;
+        p += k + (p[k] == ',');
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--tool PATH] [--gen PATH] [--sizes \"10 100 ...\"] "
+                    "[--budget NODES] [--modes name,...] [--timeout SEC] "
+                    "[--max-output MB] [--seed S] [--tmp DIR]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    const char* sizes = "10 100 1000 10000 100000 1000000";
+    const char* modes = NULL;
+    unsigned long budget = 2000000;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) usage(argv[0]);
+        const char* v = argv[i + 1];
+        if      (strcmp(argv[i], "--tool") == 0)       tool_path = v;
+        else if (strcmp(argv[i], "--gen") == 0)        gen_path = v;
+        else if (strcmp(argv[i], "--sizes") == 0)      sizes = v;
+        else if (strcmp(argv[i], "--budget") == 0)     budget = strtoul(v, NULL, 10);
+        else if (strcmp(argv[i], "--modes") == 0)      modes = v;
+        else if (strcmp(argv[i], "--timeout") == 0)    timeout_sec = (unsigned)strtoul(v, NULL, 10);
+        else if (strcmp(argv[i], "--max-output") == 0) max_output_mb = strtoul(v, NULL, 10);
+        else if (strcmp(argv[i], "--seed") == 0)       seed = strtoull(v, NULL, 10);
+        else if (strcmp(argv[i], "--tmp") == 0)        tmp_dir = v;
+        else usage(argv[0]);
+        i++;
+    }
+    if (modes) {
+        for (const char* p = modes; *p; ) {
+            size_t k = strcspn(p, ",");
+            size_t m;
+            for (m = 0; m < NMODES; m++)
+                if (strlen(MODES[m].name) == k && strncmp(p, MODES[m].name, k) == 0) break;
+            if (m == NMODES) {
+                fprintf(stderr, "Error: unknown mode '%.*s'\n", (int)k, p);
+                return 1;
+            }
+            p += k + (p[k] == ',');
+        }
+    }
+
+    char tmpl[] = "/tmp/regex_bench.XXXXXX";
+    if (!tmp_dir && !(tmp_dir = mkdtemp(tmpl))) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char in_path[4096], out_path[4096], str_path[4096], dfa_path[4096];
+    snprintf(in_path,  sizeof in_path,  "%s/input.txt",   tmp_dir);
+    snprintf(out_path, sizeof out_path, "%s/output.txt",  tmp_dir);
+    snprintf(str_path, sizeof str_path, "%s/strings.txt", tmp_dir);
+    snprintf(dfa_path, sizeof dfa_path, "%s/output.dfa",  tmp_dir);
+    if (!write_strings(str_path)) {
+        fprintf(stderr, "Error: cannot write %s\n", str_path);
+        return 1;
+    }
+
+    for (const char* p = sizes; *p; ) {
+        char* end;
+        unsigned long size = strtoul(p, &end, 10);
+        if (end == p) break;
+        p = end + strspn(end, " ,");
+        if (size == 0) continue;
+        unsigned long lines = budget / size ? budget / size : 1;
+
+        char s_seed[32], s_size[32], s_lines[32];
+        snprintf(s_seed,  sizeof s_seed,  "%llu", seed);
+        snprintf(s_size,  sizeof s_size,  "%lu", size);
+        snprintf(s_lines, sizeof s_lines, "%lu", lines);
+        char* gen_argv[] = { (char*)gen_path, "-s", s_seed, "-n", s_size, "-l", s_lines, NULL };
+        Result g;
+        if (!run(gen_argv, NULL, in_path, &g)) return 1;
+        if (strcmp(g.status, "ok") != 0) {
+            fprintf(stderr, "Error: %s failed (%s)\n", gen_path, g.status);
+            return 1;
+        }
+        long long nodes = g.out_bytes - (long long)lines;
+        int compiled = 0;                   // dfa_path holds this size's automata
+
+        for (size_t m = 0; m < NMODES; m++) {
+            if (!selected(modes, MODES[m].name)) continue;
+            char* tool_argv[MAX_ARGS + 2] = { (char*)tool_path };
+            int k = 1;
+            for (const char* const* a = MODES[m].args; *a; a++)
+                tool_argv[k++] = strcmp(*a, "@S") == 0 ? str_path
+                               : strcmp(*a, "@D") == 0 ? dfa_path
+                               : strcmp(*a, "@I") == 0 ? in_path : (char*)*a;
+            tool_argv[k] = NULL;
+
+            Result r;
+            int load = is_mode(&MODES[m], "--load");
+            if (load && !compiled) {
+                // --load needs automata for these regexes; build them untimed
+                char* compile_argv[] = { (char*)tool_path, "--compile", dfa_path, NULL };
+                if (!run(compile_argv, in_path, out_path, &r)) return 1;
+                compiled = strcmp(r.status, "ok") == 0;
+            }
+            if (!run(tool_argv, load ? str_path : in_path, out_path, &r))
+                return 1;
+            if (is_mode(&MODES[m], "--compile")) {
+                r.out_bytes = file_size(dfa_path);
+                compiled = strcmp(r.status, "ok") == 0;
+            }
+            printf("{\"mode\":\"%s\",\"size\":%lu,\"lines\":%lu,\"nodes\":%lld,"
+                   "\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"ns_per_node\":%.2f,"
+                   "\"out_bytes\":%lld,\"max_rss_kb\":%ld,\"status\":\"%s\"}\n",
+                   MODES[m].name, size, lines, nodes, r.wall_ms, r.cpu_ms,
+                   nodes > 0 ? r.wall_ms * 1e6 / (double)nodes : 0.0,
+                   r.out_bytes, r.max_rss_kb, r.status);
+            fflush(stdout);
+        }
+    }
+    unlink(in_path);
+    unlink(out_path);
+    unlink(str_path);
+    unlink(dfa_path);
+    if (tmp_dir == tmpl) rmdir(tmpl);
+    return 0;
+}
@@ -0,0 +1,128 @@
+// regex_gen: seeded random regexes in postfix, for benchmarking regex_tool
+//
+// Usage: regex_gen [-s seed] [-n nodes] [-l lines] [-d depth]
+//                  [-k star-nesting] [-a alphabet] [-e empty-percent]
+//
+// Every line is one regex of about `nodes` nodes (tokens), with at most
+// `star-nesting` stars on any path.  Operators that would make a subtree
+// deeper than `depth` (0 = no limit) are avoided; only the binary
+// operators forced at the very end of a line can exceed it.  Symbols are
+// the first `alphabet` of a..z then 0..9, and `empty-percent` of the
+// leaves are '/' (the empty set).  The same seed always gives the
+// same output, on any machine.
+//
+// Regexes are built token by token with an explicit stack, so a single
+// 10^6-node line costs no recursion.  A line can come out one node
+// short when the only way to end it exactly would break a limit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static uint64_t rng_state;
+
+// splitmix64: small, fast, and the same everywhere
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static unsigned rng_below(unsigned n) {
+    return (unsigned)(rng_next() % n);
+}
+
+static const char SYMBOLS[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+typedef struct Item {
+    unsigned depth;                     // height of the subtree
+    unsigned stars;                     // most stars on one root-to-leaf path
+} Item;
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-s seed] [-n nodes] [-l lines] [-d depth] "
+                    "[-k star-nesting] [-a alphabet] [-e empty-percent]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned long long seed = 1;
+    unsigned long nodes = 100, lines = 1;
+    unsigned depth = 0, max_stars = 3, alphabet = 3, empty_pct = 5;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i + 1 >= argc) usage(argv[0]);
+        unsigned long long v = strtoull(argv[i + 1], NULL, 10);
+        switch (argv[i][1]) {
+          case 's': seed = v;                   break;
+          case 'n': nodes = (unsigned long)v;   break;
+          case 'l': lines = (unsigned long)v;   break;
+          case 'd': depth = (unsigned)v;        break;
+          case 'k': max_stars = (unsigned)v;    break;
+          case 'a': alphabet = (unsigned)v;     break;
+          case 'e': empty_pct = (unsigned)v;    break;
+          default:  usage(argv[0]);
+        }
+        i++;
+    }
+    if (nodes == 0 || alphabet == 0 || alphabet > strlen(SYMBOLS) || empty_pct > 100)
+        usage(argv[0]);
+    rng_state = seed;
+
+    Item* stack = malloc(nodes * sizeof *stack);
+    char* line  = malloc(nodes + 1);
+    if (!stack || !line) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    for (unsigned long ln = 0; ln < lines; ln++) {
+        size_t m = 0, len = 0;
+        for (unsigned long left = nodes; left > 0; left--) {
+            // After this token, left - 1 remain, and the m' items then on
+            // the stack still need m' - 1 binary operators.
+            int can_leaf = left - 1 >= m;
+            int can_star = m >= 1 && left - 1 >= m - 1
+                           && stack[m - 1].stars < max_stars
+                           && (!depth || stack[m - 1].depth < depth);
+            int can_bin  = m >= 2;
+            if (can_bin && depth) {
+                unsigned d = stack[m - 1].depth > stack[m - 2].depth
+                           ? stack[m - 1].depth : stack[m - 2].depth;
+                if (d >= depth && (can_leaf || can_star)) can_bin = 0;
+            }
+            if (!can_leaf && !can_star && !can_bin) break;     // m == 1: done early
+
+            unsigned w_leaf = can_leaf ? 45 : 0;
+            unsigned w_bin  = can_bin  ? 45 : 0;
+            unsigned w_star = can_star ? 10 : 0;
+            unsigned pick = rng_below(w_leaf + w_bin + w_star);
+            if (pick < w_leaf) {
+                line[len++] = rng_below(100) < empty_pct ? '/' : SYMBOLS[rng_below(alphabet)];
+                stack[m].depth = 1;
+                stack[m].stars = 0;
+                m++;
+            } else if (pick < w_leaf + w_bin) {
+                line[len++] = rng_below(2) ? '+' : '.';
+                Item* a = &stack[m - 2];
+                Item* b = &stack[m - 1];
+                a->depth = 1 + (a->depth > b->depth ? a->depth : b->depth);
+                if (b->stars > a->stars) a->stars = b->stars;
+                m--;
+            } else {
+                line[len++] = '*';
+                stack[m - 1].depth++;
+                stack[m - 1].stars++;
+            }
+        }
+        line[len++] = '\n';
+        if (fwrite(line, 1, len, stdout) != len) {
+            perror("write");
+            return 1;
+        }
+    }
+    free(stack);
+    free(line);
+    return fflush(stdout) != 0;
+}
@@ -2,41 +2,281 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 typedef enum { NODE_EMPTY, NODE_CHAR, NODE_UNION, NODE_CONCAT, NODE_STAR } NodeType;
 
+// Sets of alphabet symbols are 64-bit masks indexed by sym_index().
+typedef uint64_t SymSet;
+
+// [0-9] -> 0..9, [a-z] -> 10..35, [A-Z] -> 36..61
+static int sym_index(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'Z') return c - 'A' + 36;
+    return -1;
+}
+
+static char index_sym(int i) {
+    return i < 10 ? '0' + i : i < 36 ? 'a' + (i - 10) : 'A' + (i - 36);
+}
+
+static SymSet sym_bit(char c) {
+    int i = sym_index(c);
+    return i < 0 ? 0 : (SymSet)1 << i;
+}
+
+// Language attributes cached on every node (see node_attrs)
+#define ATTR_EMPTY    0x01      // L(r) = ∅
+#define ATTR_EPS      0x02      // ε ∈ L(r)
+#define ATTR_NONEPS   0x04      // has_nonepsilon
+#define ATTR_INFINITE 0x08      // L(r) is infinite
+#define ATTR_EMPTY_SUB 0x10     // some subterm (maybe r itself) has L = ∅
+
 typedef struct RegexNode {
     NodeType type;
     char symbol;                // only for NODE_CHAR
+    unsigned char attrs;        // ATTR_* bits
+    SymSet uses;                // symbols occurring in some w ∈ L(r)
     struct RegexNode *left;
     struct RegexNode *right;
+    struct RegexNode *next;     // hash-chain link inside the node store
+    unsigned long hash;         // structural hash, stable across runs
+    unsigned long walk;         // id of the last traversal that visited it
+    union {                     // that traversal's result for this node
+        struct RegexNode* node;
+        struct { SymSet first, last; } sets;
+        unsigned long count;
+    } scratch;
 } RegexNode;
 
 // ─────────────────────────────────────────────────────────────────
-// Helpers to build, clone, and free trees
+// Counted heap allocation
+//
+// All heap traffic goes through these wrappers so --alloc-stats can
+// show that steady-state lines do no allocation at all.  The counters,
+// like all per-line state below, are thread-local so --jobs workers
+// never share them.
+// ─────────────────────────────────────────────────────────────────
+static _Thread_local unsigned long alloc_calls = 0;
+static _Thread_local unsigned long alloc_bytes = 0;
+
+static void* xmalloc(size_t n) {
+    void* p = malloc(n);
+    if (!p) { fprintf(stderr, "Error: out of memory\n"); exit(1); }
+    alloc_calls++;
+    alloc_bytes += n;
+    return p;
+}
+
+static void* xcalloc(size_t count, size_t size) {
+    void* p = calloc(count, size);
+    if (!p) { fprintf(stderr, "Error: out of memory\n"); exit(1); }
+    alloc_calls++;
+    alloc_bytes += count * size;
+    return p;
+}
+
+static void* xrealloc(void* old, size_t n) {
+    void* p = realloc(old, n);
+    if (!p) { fprintf(stderr, "Error: out of memory\n"); exit(1); }
+    alloc_calls++;
+    alloc_bytes += n;
+    return p;
+}
+
+// ─────────────────────────────────────────────────────────────────
+// Hash-consed node store
+//
+// Every node is interned: make_node returns the existing node for an
+// identical (type, symbol, left, right), so equal subterms are shared
+// and the trees are really DAGs.  Nodes are immutable once built --
+// never write through a RegexNode* -- which makes clone_tree free and
+// structural equality a pointer comparison.
+//
+// Nodes are bump-allocated from a pool of fixed-size chunks.  The pool
+// and the bucket array are kept for the life of the process; after each
+// input line store_reset() rewinds the bump pointer and unlinks the
+// buckets it used, so once the pool is big enough for the largest line
+// no further allocation happens.
 // ─────────────────────────────────────────────────────────────────
+#define STORE_CHUNK_NODES 4096
+
+typedef struct NodeChunk {
+    struct NodeChunk* next;
+    RegexNode nodes[STORE_CHUNK_NODES];
+} NodeChunk;
+
+static _Thread_local NodeChunk*  store_first   = NULL;   // pool of chunks, in order
+static _Thread_local NodeChunk*  store_cur     = NULL;   // chunk being bump-allocated
+static _Thread_local size_t      store_used    = 0;      // nodes used in store_cur
+static _Thread_local RegexNode** store_buckets = NULL;
+static _Thread_local size_t      store_nbuckets = 0;
+static _Thread_local size_t      store_count    = 0;     // interned nodes
+
+// Running totals for --stats; bumped unconditionally, read per line.
+static _Thread_local unsigned long make_calls  = 0;
+static _Thread_local unsigned long clone_calls = 0;
+static _Thread_local unsigned long parse_nodes = 0;
+
+// Structural hash: built from the children's hashes, not their
+// addresses, so it is the same in every run and every thread.
+static unsigned long node_hash(NodeType type, char symbol, RegexNode* left, RegexNode* right) {
+    unsigned long h = ((unsigned long)type << 8 | (unsigned char)symbol) * 0x9E3779B97F4A7C15UL;
+    h = (h ^ (left ? left->hash : 0x85EBCA6B27D4EB4FUL)) * 0xFF51AFD7ED558CCDUL;
+    h = ((h << 29 | h >> 35) ^ (right ? right->hash : 0x27D4EB2F165667C5UL)) * 0xC4CEB9FE1A85EC53UL;
+    return h ^ (h >> 32);
+}
+
+// Bucket hash: mixes the child addresses instead.  Children are built
+// just before their parents, so related nodes land in nearby buckets,
+// which is much kinder to the cache than the structural hash.
+static unsigned long slot_hash(NodeType type, char symbol, RegexNode* left, RegexNode* right) {
+    unsigned long h = (unsigned long)type * 0x9E3779B97F4A7C15UL;
+    h ^= (unsigned char)symbol + 0x7F4A7C15UL + (h << 6) + (h >> 2);
+    h ^= (unsigned long)(uintptr_t)left  + 0x9E3779B9UL + (h << 6) + (h >> 2);
+    h ^= (unsigned long)(uintptr_t)right + 0x85EBCA6BUL + (h << 6) + (h >> 2);
+    return h ^ (h >> 29);
+}
+#define NODE_SLOT(e) slot_hash((e)->type, (e)->symbol, (e)->left, (e)->right)
+
+static void store_grow(void) {
+    size_t n = store_nbuckets ? store_nbuckets * 2 : 1024;
+    RegexNode** b = xcalloc(n, sizeof *b);
+    for (size_t i = 0; i < store_nbuckets; i++) {
+        RegexNode* e = store_buckets[i];
+        while (e) {
+            RegexNode* nx = e->next;
+            unsigned long slot = NODE_SLOT(e) & (n - 1);
+            e->next = b[slot];
+            b[slot] = e;
+            e = nx;
+        }
+    }
+    free(store_buckets);
+    store_buckets  = b;
+    store_nbuckets = n;
+}
+
+static RegexNode* store_alloc(void) {
+    if (!store_cur || store_used == STORE_CHUNK_NODES) {
+        NodeChunk* c = store_cur ? store_cur->next : store_first;
+        if (!c) {
+            c = xmalloc(sizeof *c);
+            c->next = NULL;
+            if (store_cur) store_cur->next = c;
+            else           store_first     = c;
+        }
+        store_cur  = c;
+        store_used = 0;
+    }
+    return &store_cur->nodes[store_used++];
+}
+
+// Forget every node built for the current line.  The chunks stay in the
+// pool for the next line; only the buckets that were touched are cleared,
+// unless the table is mostly full and one memset is cheaper.
+void store_reset(void) {
+    if (store_count && store_count * 4 >= store_nbuckets) {
+        memset(store_buckets, 0, store_nbuckets * sizeof *store_buckets);
+        store_count = 0;
+    }
+    for (NodeChunk* c = store_first; c && store_count; c = c->next) {
+        size_t n = (c == store_cur) ? store_used : STORE_CHUNK_NODES;
+        for (size_t i = 0; i < n; i++)
+            store_buckets[NODE_SLOT(&c->nodes[i]) & (store_nbuckets - 1)] = NULL;
+        if (c == store_cur) break;
+    }
+    store_cur   = NULL;
+    store_used  = 0;
+    store_count = 0;
+}
+
+// Fill in the cached language attributes of a new node from its
+// (already interned) children, so every query below is a lookup.
+static void node_attrs(RegexNode* n) {
+    RegexNode* l = n->left;
+    RegexNode* r = n->right;
+    unsigned char a = 0;
+    switch (n->type) {
+      case NODE_EMPTY:
+        a = ATTR_EMPTY;
+        n->uses = 0;
+        break;
+      case NODE_CHAR:
+        a = ATTR_NONEPS;
+        n->uses = sym_bit(n->symbol);
+        break;
+      case NODE_STAR:
+        // r* always has ε; it is infinite iff its body has a non-ε string
+        a = ATTR_EPS;
+        if (l->attrs & ATTR_NONEPS) a |= ATTR_NONEPS | ATTR_INFINITE;
+        n->uses = l->uses;
+        break;
+      case NODE_UNION:
+        a = (l->attrs | r->attrs) & (ATTR_EPS | ATTR_NONEPS | ATTR_INFINITE);
+        a |= l->attrs & r->attrs & ATTR_EMPTY;
+        n->uses = l->uses | r->uses;
+        break;
+      case NODE_CONCAT: {
+        int le = l->attrs & ATTR_EMPTY,  re = r->attrs & ATTR_EMPTY;
+        int lp = l->attrs & ATTR_EPS,    rp = r->attrs & ATTR_EPS;
+        int ln = l->attrs & ATTR_NONEPS, rn = r->attrs & ATTR_NONEPS;
+        if (le || re)  a |= ATTR_EMPTY;
+        if (lp && rp)  a |= ATTR_EPS;
+        // a non-ε string on one side, anything on the other
+        if ((ln && (rp || rn)) || (rn && (lp || ln)))
+            a |= ATTR_NONEPS;
+        if (((l->attrs & ATTR_INFINITE) && !re) || ((r->attrs & ATTR_INFINITE) && !le))
+            a |= ATTR_INFINITE;
+        n->uses = (re ? 0 : l->uses) | (le ? 0 : r->uses);
+        break;
+      }
+    }
+    if ((a & ATTR_EMPTY) || (l && (l->attrs & ATTR_EMPTY_SUB))
+        || (r && (r->attrs & ATTR_EMPTY_SUB)))
+        a |= ATTR_EMPTY_SUB;
+    n->attrs = a;
+}
+
 RegexNode* make_node(NodeType type, char symbol, RegexNode* left, RegexNode* right) {
-    RegexNode* node = malloc(sizeof(RegexNode));
+    make_calls++;
+    unsigned long slot = slot_hash(type, symbol, left, right);
+    if (store_nbuckets) {
+        for (RegexNode* e = store_buckets[slot & (store_nbuckets - 1)]; e; e = e->next)
+            if (e->left == left && e->right == right
+                && e->type == type && e->symbol == symbol)
+                return e;
+    }
+    if (store_count >= store_nbuckets) store_grow();
+    RegexNode* node = store_alloc();
     node->type   = type;
     node->symbol = symbol;
     node->left   = left;
     node->right  = right;
+    node->hash   = node_hash(type, symbol, left, right);
+    node->walk   = 0;
+    node_attrs(node);
+    node->next   = store_buckets[slot & (store_nbuckets - 1)];
+    store_buckets[slot & (store_nbuckets - 1)] = node;
+    store_count++;
     return node;
 }
 
-void free_tree(RegexNode* node) {
-    if (!node) return;
-    free_tree(node->left);
-    free_tree(node->right);
-    free(node);
-}
-
+// Interned nodes are immutable and shared, so a clone is the node itself.
 RegexNode* clone_tree(RegexNode* n) {
-    if (!n) return NULL;
-    return make_node(n->type,
-                     n->symbol,
-                     clone_tree(n->left),
-                     clone_tree(n->right));
+    clone_calls++;
+    return n;
 }
 
 // ε is represented as "/" under a star
@@ -46,56 +286,459 @@ RegexNode* make_epsilon() {
 }
 
 // ─────────────────────────────────────────────────────────────────
-// Parse a postfix regex into a syntax tree
+// Parse a postfix, prefix or infix regex into a syntax tree
+//
+// The line is not NUL-terminated (it may point straight into an mmap'd
+// input file), so the length is passed explicitly.  The operand stack
+// grows as needed and is kept between lines.  Each parser returns NULL
+// if the line is blank or not a single well-formed regex.  None of them
+// recurse, so nesting depth is unlimited.
 // ─────────────────────────────────────────────────────────────────
-RegexNode* parse_postfix(const char* line) {
-    RegexNode* stack[1000];
-    int top = 0;
-    for (int i = 0; line[i]; i++) {
+static _Thread_local RegexNode** parse_stack = NULL;
+static _Thread_local size_t      parse_cap   = 0;
+
+static void parse_reserve(size_t n) {
+    if (n <= parse_cap) return;
+    while (parse_cap < n)
+        parse_cap = parse_cap ? parse_cap * 2 : 1024;
+    parse_stack = xrealloc(parse_stack, parse_cap * sizeof *parse_stack);
+}
+
+RegexNode* parse_postfix(const char* line, size_t len) {
+    size_t top = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = line[i];
+        if (isspace((unsigned char)c)) continue;
+        parse_reserve(top + 1);
+        if (c == '/') {
+            parse_stack[top++] = make_node(NODE_EMPTY, 0, NULL, NULL);
+        } else if (isalnum((unsigned char)c)) {
+            parse_stack[top++] = make_node(NODE_CHAR, c, NULL, NULL);
+        } else if (c == '*') {
+            if (top < 1) return NULL;
+            RegexNode* a = parse_stack[--top];
+            parse_stack[top++] = make_node(NODE_STAR, '*', a, NULL);
+        } else if (c == '+') {
+            if (top < 2) return NULL;
+            RegexNode* b = parse_stack[--top];
+            RegexNode* a = parse_stack[--top];
+            parse_stack[top++] = make_node(NODE_UNION, '+', a, b);
+        } else if (c == '.') {
+            if (top < 2) return NULL;
+            RegexNode* b = parse_stack[--top];
+            RegexNode* a = parse_stack[--top];
+            parse_stack[top++] = make_node(NODE_CONCAT, '.', a, b);
+        }
+    }
+    return top == 1 ? parse_stack[0] : NULL;
+}
+
+// Prefix read right to left is postfix with the operands swapped: when
+// an operator is reached, its left operand is on top of the stack.
+RegexNode* parse_prefix(const char* line, size_t len) {
+    size_t top = 0;
+    for (size_t i = len; i-- > 0; ) {
         char c = line[i];
-        if (isspace(c)) continue;
+        if (isspace((unsigned char)c)) continue;
+        parse_reserve(top + 1);
         if (c == '/') {
-            stack[top++] = make_node(NODE_EMPTY, 0, NULL, NULL);
-        } else if (isalnum(c)) {
-            stack[top++] = make_node(NODE_CHAR, c, NULL, NULL);
+            parse_stack[top++] = make_node(NODE_EMPTY, 0, NULL, NULL);
+        } else if (isalnum((unsigned char)c)) {
+            parse_stack[top++] = make_node(NODE_CHAR, c, NULL, NULL);
         } else if (c == '*') {
-            RegexNode* a = stack[--top];
-            stack[top++] = make_node(NODE_STAR, '*', a, NULL);
+            if (top < 1) return NULL;
+            RegexNode* a = parse_stack[--top];
+            parse_stack[top++] = make_node(NODE_STAR, '*', a, NULL);
         } else if (c == '+') {
-            RegexNode* b = stack[--top];
-            RegexNode* a = stack[--top];
-            stack[top++] = make_node(NODE_UNION, '+', a, b);
+            if (top < 2) return NULL;
+            RegexNode* a = parse_stack[--top];
+            RegexNode* b = parse_stack[--top];
+            parse_stack[top++] = make_node(NODE_UNION, '+', a, b);
         } else if (c == '.') {
-            RegexNode* b = stack[--top];
-            RegexNode* a = stack[--top];
-            stack[top++] = make_node(NODE_CONCAT, '.', a, b);
+            if (top < 2) return NULL;
+            RegexNode* a = parse_stack[--top];
+            RegexNode* b = parse_stack[--top];
+            parse_stack[top++] = make_node(NODE_CONCAT, '.', a, b);
+        }
+    }
+    return top == 1 ? parse_stack[0] : NULL;
+}
+
+// Infix, with the same grammar as in2post: '+' binds loosest, then
+// concatenation by juxtaposition, then postfix '*'; both binary
+// operators group to the left.  Operator-precedence parsing with an
+// explicit operator stack ('(', '+', '.') keeps it non-recursive.
+static _Thread_local char*  op_stack = NULL;
+static _Thread_local size_t op_cap   = 0;
+
+// Apply the operator on top of op_stack to the top two operands.
+static int infix_reduce(size_t* top, size_t* otop) {
+    if (*top < 2) return 0;
+    char op = op_stack[--*otop];
+    RegexNode* b = parse_stack[--*top];
+    RegexNode* a = parse_stack[--*top];
+    parse_stack[(*top)++] = (op == '+') ? make_node(NODE_UNION, '+', a, b)
+                                        : make_node(NODE_CONCAT, '.', a, b);
+    return 1;
+}
+
+// Push op; a binary operator first reduces everything that binds at
+// least as tightly (left associativity).  '(' is pushed as is.
+static int infix_push_op(char op, size_t* top, size_t* otop) {
+    while (op != '(' && *otop > 0 && op_stack[*otop - 1] != '('
+           && (op == '+' || op_stack[*otop - 1] == '.'))
+        if (!infix_reduce(top, otop)) return 0;
+    if (*otop == op_cap) {
+        op_cap = op_cap ? op_cap * 2 : 1024;
+        op_stack = xrealloc(op_stack, op_cap);
+    }
+    op_stack[(*otop)++] = op;
+    return 1;
+}
+
+RegexNode* parse_infix(const char* line, size_t len) {
+    size_t top = 0, otop = 0;
+    int operand = 0;            // did the previous token end an operand?
+    for (size_t i = 0; i < len; i++) {
+        char c = line[i];
+        if (isspace((unsigned char)c)) continue;
+        if (c == '/' || isalnum((unsigned char)c) || c == '(') {
+            if (operand && !infix_push_op('.', &top, &otop)) return NULL;
+            if (c == '(') {
+                if (!infix_push_op('(', &top, &otop)) return NULL;
+                operand = 0;
+                continue;
+            }
+            parse_reserve(top + 1);
+            parse_stack[top++] = (c == '/') ? make_node(NODE_EMPTY, 0, NULL, NULL)
+                                            : make_node(NODE_CHAR, c, NULL, NULL);
+            operand = 1;
+        } else if (c == '*') {
+            if (!operand) return NULL;
+            parse_stack[top - 1] = make_node(NODE_STAR, '*', parse_stack[top - 1], NULL);
+        } else if (c == '+') {
+            if (!operand || !infix_push_op('+', &top, &otop)) return NULL;
+            operand = 0;
+        } else if (c == ')') {
+            if (!operand) return NULL;
+            while (otop > 0 && op_stack[otop - 1] != '(')
+                if (!infix_reduce(&top, &otop)) return NULL;
+            if (otop == 0) return NULL;
+            otop--;
+        } else {
+            return NULL;
+        }
+    }
+    if (!operand && top > 0) return NULL;
+    while (otop > 0)
+        if (op_stack[otop - 1] == '(' || !infix_reduce(&top, &otop)) return NULL;
+    return top == 1 ? parse_stack[0] : NULL;
+}
+
+// ─────────────────────────────────────────────────────────────────
+// Output buffers
+//
+// Results are appended byte by byte to an OutBuf instead of going
+// through stdio: no format parsing and no FILE locking.  A buffer tied
+// to a file descriptor is drained with write(2) whenever it fills; one
+// with fd < 0 (a --jobs chunk) just grows and is later handed to
+// writev() by the main thread.  `out` is the current thread's target.
+// ─────────────────────────────────────────────────────────────────
+#define OUT_BUFSIZE (1 << 20)
+#ifndef IOV_MAX
+#define IOV_MAX 16              // the POSIX minimum
+#endif
+
+typedef struct OutBuf {
+    char*  data;
+    size_t len, cap;
+    int    fd;              // flush target, or -1 to grow in memory
+    size_t flushed;         // number of flushes so far
+} OutBuf;
+
+static _Thread_local OutBuf* out;
+
+// write(2) every byte of the iovec array, retrying short writes.
+static void write_all_iov(int fd, struct iovec* iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("write");
+            exit(1);
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
         }
     }
-    return top == 1 ? stack[0] : NULL;
 }
 
-// Print in prefix (Polish) notation
+static void out_flush(OutBuf* o) {
+    if (o->fd >= 0 && o->len > 0) {
+        struct iovec v = { o->data, o->len };
+        write_all_iov(o->fd, &v, 1);
+        o->len = 0;
+        o->flushed++;
+    }
+}
+
+static void out_make_room(OutBuf* o, size_t n) {
+    if (o->fd >= 0) {
+        out_flush(o);
+        if (n <= o->cap) return;
+    }
+    while (o->cap - o->len < n)
+        o->cap = o->cap ? o->cap * 2 : OUT_BUFSIZE;
+    o->data = xrealloc(o->data, o->cap);
+}
+
+static inline void out_byte(OutBuf* o, char c) {
+    if (o->len == o->cap) out_make_room(o, 1);
+    o->data[o->len++] = c;
+}
+
+static void out_str(OutBuf* o, const char* str) {
+    size_t n = strlen(str);
+    if (o->cap - o->len < n) out_make_room(o, n);
+    memcpy(o->data + o->len, str, n);
+    o->len += n;
+}
+
+// ─────────────────────────────────────────────────────────────────
+// Iterative traversal engine
+//
+// Nothing below recurses on the C stack: arbitrarily deep regexes only
+// grow walk_stack, which is thread-local and kept between lines.
+//
+// walk_postorder() calls fn once per distinct node reachable from root,
+// children before parents.  Each node records the id of the walk that
+// visited it, so shared subterms are done once and a walk costs
+// O(DAG size).  fn leaves its result in node->scratch, where the
+// parent's call finds it.  Walks must not nest: fn may build nodes, but
+// must not start another walk.
+// ─────────────────────────────────────────────────────────────────
+typedef void (*VisitFn)(RegexNode* node, void* ctx);
+
+static _Thread_local RegexNode** walk_stack = NULL;
+static _Thread_local size_t      walk_cap   = 0;
+static _Thread_local unsigned long walk_id  = 0;
+
+static void walk_reserve(size_t n) {
+    if (n <= walk_cap) return;
+    while (walk_cap < n)
+        walk_cap = walk_cap ? walk_cap * 2 : 1024;
+    walk_stack = xrealloc(walk_stack, walk_cap * sizeof *walk_stack);
+}
+
+static void walk_push(size_t* top, RegexNode* n) {
+    walk_reserve(*top + 1);
+    walk_stack[(*top)++] = n;
+}
+
+static void walk_postorder(RegexNode* root, VisitFn fn, void* ctx) {
+    if (!root) return;
+    unsigned long id = ++walk_id;
+    size_t top = 0;
+    walk_push(&top, root);
+    while (top) {
+        RegexNode* n = walk_stack[top - 1];
+        if (n->walk == id) { top--; continue; }
+        if (n->left && n->left->walk != id)   { walk_push(&top, n->left);  continue; }
+        if (n->right && n->right->walk != id) { walk_push(&top, n->right); continue; }
+        fn(n, ctx);
+        n->walk = id;
+        top--;
+    }
+}
+
+// rewrite() maps a regex bottom-up: fn gets a node together with the
+// already-rewritten children (NULL where the node has none) and returns
+// the node's image.
+typedef RegexNode* (*RewriteFn)(RegexNode* node, RegexNode* l, RegexNode* r, void* ctx);
+
+typedef struct RewriteCtx {
+    RewriteFn fn;
+    void*     ctx;
+} RewriteCtx;
+
+static void rewrite_visit(RegexNode* n, void* p) {
+    RewriteCtx* rc = p;
+    n->scratch.node = rc->fn(n,
+                             n->left  ? n->left->scratch.node  : NULL,
+                             n->right ? n->right->scratch.node : NULL,
+                             rc->ctx);
+}
+
+RegexNode* rewrite(RegexNode* root, RewriteFn fn, void* ctx) {
+    if (!root) return NULL;
+    RewriteCtx rc = { fn, ctx };
+    walk_postorder(root, rewrite_visit, &rc);
+    return root->scratch.node;
+}
+
+// Print in prefix (Polish) notation.  This expands the DAG back into a
+// tree, so it walks paths rather than distinct nodes.  It is the hot
+// loop for the big transforms, so the output cursor and the stack are
+// kept in locals and only written back when either has to grow.
 void print_prefix(RegexNode* node) {
     if (!node) return;
-    switch (node->type) {
-      case NODE_EMPTY:  printf("/");                          break;
-      case NODE_CHAR:   printf("%c", node->symbol);           break;
-      case NODE_STAR:   printf("*");    print_prefix(node->left);            break;
-      case NODE_UNION:  printf("+");    print_prefix(node->left);  print_prefix(node->right); break;
-      case NODE_CONCAT: printf(".");    print_prefix(node->left);  print_prefix(node->right); break;
+    OutBuf* o = out;
+    char* p   = o->data + o->len;
+    char* end = o->data + o->cap;
+    walk_reserve(2);
+    RegexNode** stack = walk_stack;
+    size_t cap = walk_cap, top = 0;
+    stack[top++] = node;
+    while (top) {
+        RegexNode* n = stack[--top];
+        if (p == end) {
+            o->len = (size_t)(p - o->data);
+            out_make_room(o, 1);
+            p   = o->data + o->len;
+            end = o->data + o->cap;
+        }
+        // operator characters indexed by NodeType (NODE_CHAR prints its symbol)
+        *p++ = n->type == NODE_CHAR ? n->symbol : "/ +.*"[n->type];
+        if (top + 2 > cap) {
+            walk_reserve(top + 2);
+            stack = walk_stack;
+            cap   = walk_cap;
+        }
+        if (n->right) stack[top++] = n->right;
+        if (n->left)  stack[top++] = n->left;
+    }
+    o->len = (size_t)(p - o->data);
+}
+
+// Postfix and infix printing share an explicit stack of pending items:
+// a node still to print (with the precedence of its context, for
+// infix) or a literal character (n == NULL).
+typedef struct PrintItem {
+    RegexNode* n;
+    int        arg;             // precedence, or the literal character
+} PrintItem;
+
+static _Thread_local PrintItem* print_stack = NULL;
+static _Thread_local size_t     print_cap   = 0;
+
+static void print_push(size_t* top, RegexNode* n, int arg) {
+    if (*top == print_cap) {
+        print_cap = print_cap ? print_cap * 2 : 1024;
+        print_stack = xrealloc(print_stack, print_cap * sizeof *print_stack);
+    }
+    print_stack[*top].n   = n;
+    print_stack[*top].arg = arg;
+    (*top)++;
+}
+
+// Print in postfix notation (the input format of parse_postfix).
+void print_postfix(RegexNode* node) {
+    if (!node) return;
+    size_t top = 0;
+    print_push(&top, node, 0);
+    while (top) {
+        PrintItem it = print_stack[--top];
+        if (!it.n) { out_byte(out, (char)it.arg); continue; }
+        RegexNode* n = it.n;
+        if (n->type == NODE_EMPTY || n->type == NODE_CHAR) {
+            out_byte(out, n->type == NODE_CHAR ? n->symbol : '/');
+            continue;
+        }
+        print_push(&top, NULL, n->symbol);
+        if (n->right) print_push(&top, n->right, 0);
+        print_push(&top, n->left, 0);
+    }
+}
+
+// Print in infix notation with the minimal parentheses, exactly as
+// pre2in does: precedence 0 for '+', 1 for concatenation, 2 under '*'.
+void print_infix(RegexNode* node) {
+    if (!node) return;
+    size_t top = 0;
+    print_push(&top, node, 0);
+    while (top) {
+        PrintItem it = print_stack[--top];
+        if (!it.n) { out_byte(out, (char)it.arg); continue; }
+        RegexNode* n = it.n;
+        int prec = it.arg;
+        switch (n->type) {
+          case NODE_EMPTY:  out_byte(out, '/');        break;
+          case NODE_CHAR:   out_byte(out, n->symbol);  break;
+          case NODE_STAR:
+            print_push(&top, NULL, '*');
+            print_push(&top, n->left, 2);
+            break;
+          case NODE_CONCAT:
+            if (prec > 1) { out_byte(out, '('); print_push(&top, NULL, ')'); }
+            print_push(&top, n->right, 1);
+            print_push(&top, n->left, 1);
+            break;
+          case NODE_UNION:
+            if (prec > 0) { out_byte(out, '('); print_push(&top, NULL, ')'); }
+            print_push(&top, n->right, 0);
+            print_push(&top, NULL, '+');
+            print_push(&top, n->left, 0);
+            break;
+        }
+    }
+}
+
+// --in= / --out= notation
+typedef enum { FMT_POSTFIX, FMT_PREFIX, FMT_INFIX } Format;
+
+static Format in_format  = FMT_POSTFIX;
+static Format out_format = FMT_PREFIX;
+
+static int parse_format(const char* name, Format* f) {
+    if      (strcmp(name, "postfix") == 0) *f = FMT_POSTFIX;
+    else if (strcmp(name, "prefix")  == 0) *f = FMT_PREFIX;
+    else if (strcmp(name, "infix")   == 0) *f = FMT_INFIX;
+    else return 0;
+    return 1;
+}
+
+// Parse one input line in the --in notation; '#' starts a comment, as
+// in the csce355-proj-utils tools.
+RegexNode* parse_line(const char* line, size_t len) {
+    const char* hash = memchr(line, '#', len);
+    if (hash) len = (size_t)(hash - line);
+    unsigned long before = make_calls;
+    RegexNode* tree;
+    switch (in_format) {
+      case FMT_PREFIX: tree = parse_prefix(line, len);  break;
+      case FMT_INFIX:  tree = parse_infix(line, len);   break;
+      default:         tree = parse_postfix(line, len); break;
+    }
+    parse_nodes += make_calls - before;
+    return tree;
+}
+
+// Print a regex in the --out notation.
+void print_regex(RegexNode* node) {
+    switch (out_format) {
+      case FMT_POSTFIX: print_postfix(node); break;
+      case FMT_INFIX:   print_infix(node);   break;
+      default:          print_prefix(node);  break;
     }
 }
 
-// Compare two trees for structural equality
+// Compare two trees for structural equality (interned: same node iff equal)
 int trees_equal(RegexNode* a, RegexNode* b) {
-    if (!a || !b) return a == b;
-    if (a->type != b->type || a->symbol != b->symbol) return 0;
-    return trees_equal(a->left,  b->left)
-        && trees_equal(a->right, b->right);
+    return a == b;
 }
 
 // ─────────────────────────────────────────────────────────────────
 // --simplify: bottom‑up rewrite rules
+//
+// One bottom-up pass reaches the fixed point: children arrive already
+// simplified, and a rule that builds a new node (rule 5) re-runs the
+// rules on that node before handing it up.
 // ─────────────────────────────────────────────────────────────────
 static int is_exactly_empty(RegexNode *n) {
     return n && n->type == NODE_EMPTY;
@@ -104,17 +747,11 @@ static int is_empty_star(RegexNode *n) {
     return n && n->type == NODE_STAR && is_exactly_empty(n->left);
 }
 
-RegexNode* simplify(RegexNode* node) {
-    if (!node) return NULL;
-    node->left  = simplify(node->left);
-    node->right = simplify(node->right);
+static RegexNode* simplify_rules(RegexNode* node) {
 
     // 1) (s*)* → s*
-    if (node->type == NODE_STAR && node->left->type == NODE_STAR) {
-        RegexNode* keep = node->left;
-        free(node);
-        return keep;
-    }
+    if (node->type == NODE_STAR && node->left->type == NODE_STAR)
+        return node->left;
 
     // 5) (s+∅*)* → s*   and   (∅*+s)* → s*
     if (node->type == NODE_STAR && node->left->type == NODE_UNION) {
@@ -122,126 +759,286 @@ RegexNode* simplify(RegexNode* node) {
         RegexNode* s = NULL;
         if (is_empty_star(U->left))       s = U->right;
         else if (is_empty_star(U->right)) s = U->left;
-        if (s) {
-            RegexNode* s_clone = clone_tree(s);
-            free_tree(U->left);
-            free_tree(U->right);
-            free(U);
-            free(node);
-            return make_node(NODE_STAR, '*', s_clone, NULL);
-        }
+        if (s)
+            return simplify_rules(make_node(NODE_STAR, '*', s, NULL));
     }
 
     // 2) ∅ + s → s   or   s + ∅ → s
     if (node->type == NODE_UNION) {
-        if (is_exactly_empty(node->left)) {
-            RegexNode* keep = node->right;
-            free(node);
-            return keep;
-        }
-        if (is_exactly_empty(node->right)) {
-            RegexNode* keep = node->left;
-            free(node);
-            return keep;
-        }
+        if (is_exactly_empty(node->left))  return node->right;
+        if (is_exactly_empty(node->right)) return node->left;
     }
 
     // 3+4) ∅·s → ∅, s·∅ → ∅, ∅*·s → s, s·∅* → s
     if (node->type == NODE_CONCAT) {
-        if (is_exactly_empty(node->left) || is_exactly_empty(node->right)) {
-            free_tree(node->left);
-            free_tree(node->right);
-            free(node);
+        if (is_exactly_empty(node->left) || is_exactly_empty(node->right))
             return make_node(NODE_EMPTY, 0, NULL, NULL);
+        if (is_empty_star(node->left))  return node->right;
+        if (is_empty_star(node->right)) return node->left;
+    }
+
+    return node;
+}
+
+static RegexNode* simplify_step(RegexNode* node, RegexNode* l, RegexNode* r, void* ctx) {
+    (void)ctx;
+    if (l != node->left || r != node->right)
+        node = make_node(node->type, node->symbol, l, r);
+    return simplify_rules(node);
+}
+
+RegexNode* simplify(RegexNode* node) {
+    return rewrite(node, simplify_step, NULL);
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --canonical: a normal form modulo associativity, commutativity and
+// idempotence of +
+//
+// Maximal + and · clusters are treated as n-ary.  A cluster is
+// normalized once, by the first node above it of another type (or at
+// the root), when all of its arms are already canonical:
+//   +   flatten, drop ∅, sort, dedupe, drop ∅* if another arm has ε
+//   ·   flatten, ∅ if any factor is ∅, drop ∅*, s*·s* → s*
+//   *   ∅* and (∅*)* → ∅*,  (s*)* → s*,  (∅* + s + t*)* → (s + t)*
+// Clusters are rebuilt left-associated.  Every rule of --simplify is
+// subsumed, so the output is never larger than --simplify's.
+// ─────────────────────────────────────────────────────────────────
+static _Thread_local RegexNode** canon_arms = NULL;    // arms of one cluster
+static _Thread_local size_t      canon_cap  = 0;
+static _Thread_local RegexNode** canon_todo = NULL;    // flattening stack
+static _Thread_local size_t      canon_todo_cap = 0;
+
+static void canon_reserve(RegexNode*** buf, size_t* cap, size_t n) {
+    if (n <= *cap) return;
+    while (*cap < n)
+        *cap = *cap ? *cap * 2 : 256;
+    *buf = xrealloc(*buf, *cap * sizeof **buf);
+}
+
+// Append the arms of the type-t cluster rooted at n to canon_arms[*n_arms..],
+// left to right.
+static void canon_flatten(RegexNode* n, NodeType t, size_t* n_arms) {
+    size_t top = 0;
+    canon_reserve(&canon_todo, &canon_todo_cap, 1);
+    canon_todo[top++] = n;
+    while (top) {
+        n = canon_todo[--top];
+        if (n->type == t) {
+            canon_reserve(&canon_todo, &canon_todo_cap, top + 2);
+            canon_todo[top++] = n->right;
+            canon_todo[top++] = n->left;
+        } else {
+            canon_reserve(&canon_arms, &canon_cap, *n_arms + 1);
+            canon_arms[(*n_arms)++] = n;
         }
-        if (is_empty_star(node->left)) {
-            RegexNode* keep = node->right;
-            free(node);
-            return keep;
+    }
+}
+
+// Total order on interned nodes: by hash, and structurally on a collision.
+static int canon_cmp(const void* pa, const void* pb) {
+    RegexNode* a = *(RegexNode* const*)pa;
+    RegexNode* b = *(RegexNode* const*)pb;
+    while (a != b) {
+        if (a->hash != b->hash)     return a->hash < b->hash ? -1 : 1;
+        if (a->type != b->type)     return a->type < b->type ? -1 : 1;
+        if (a->symbol != b->symbol) return (unsigned char)a->symbol < (unsigned char)b->symbol ? -1 : 1;
+        if (a->left != b->left) { a = a->left; b = b->left; }
+        else                    { a = a->right; b = b->right; }
+    }
+    return 0;
+}
+
+// Build the canonical union of canon_arms[0..n).
+static RegexNode* canon_union_arms(size_t n) {
+    size_t k = 0;
+    int nullable = 0, empty_star = 0;
+    for (size_t i = 0; i < n; i++) {
+        RegexNode* a = canon_arms[i];
+        if (a->type == NODE_EMPTY) continue;
+        if (is_empty_star(a)) { empty_star = 1; continue; }
+        if (a->attrs & ATTR_EPS) nullable = 1;
+        canon_arms[k++] = a;
+    }
+    if (empty_star && !nullable) canon_arms[k++] = make_epsilon();
+    if (k == 0) return make_node(NODE_EMPTY, 0, NULL, NULL);
+    qsort(canon_arms, k, sizeof *canon_arms, canon_cmp);
+    RegexNode* r = canon_arms[0];
+    for (size_t i = 1; i < k; i++)
+        if (canon_arms[i] != canon_arms[i - 1])
+            r = make_node(NODE_UNION, '+', r, canon_arms[i]);
+    return r;
+}
+
+static RegexNode* canon_union(RegexNode* u) {
+    size_t n = 0;
+    canon_flatten(u, NODE_UNION, &n);
+    return canon_union_arms(n);
+}
+
+static RegexNode* canon_concat(RegexNode* c) {
+    size_t n = 0, k = 0;
+    canon_flatten(c, NODE_CONCAT, &n);
+    for (size_t i = 0; i < n; i++) {
+        RegexNode* f = canon_arms[i];
+        if (f->type == NODE_EMPTY) return f;
+        if (is_empty_star(f)) continue;
+        if (f->type == NODE_STAR && k && canon_arms[k - 1] == f) continue;
+        canon_arms[k++] = f;
+    }
+    if (k == 0) return make_epsilon();
+    RegexNode* r = canon_arms[0];
+    for (size_t i = 1; i < k; i++)
+        r = make_node(NODE_CONCAT, '.', r, canon_arms[i]);
+    return r;
+}
+
+static RegexNode* canon_cluster(RegexNode* n) {
+    if (n->type == NODE_UNION)  return canon_union(n);
+    if (n->type == NODE_CONCAT) return canon_concat(n);
+    return n;
+}
+
+static RegexNode* canon_star(RegexNode* body) {
+    if (body->type == NODE_EMPTY || is_empty_star(body)) return make_epsilon();
+    if (body->type == NODE_STAR) return body;
+    if (body->type == NODE_UNION) {
+        size_t n = 0, k = 0;
+        int changed = 0;
+        canon_flatten(body, NODE_UNION, &n);
+        for (size_t i = 0; i < n; i++) {
+            RegexNode* a = canon_arms[i];
+            if (is_empty_star(a)) { changed = 1; continue; }
+            if (a->type == NODE_STAR) { a = a->left; changed = 1; }
+            canon_arms[k++] = a;
         }
-        if (is_empty_star(node->right)) {
-            RegexNode* keep = node->left;
-            free(node);
-            return keep;
+        if (changed) {
+            // An unstarred arm may itself be a union: flatten it in.
+            n = k;
+            for (size_t i = 0; i < k; i++)
+                if (canon_arms[i]->type == NODE_UNION) {
+                    RegexNode* u = canon_arms[i];
+                    canon_arms[i] = make_node(NODE_EMPTY, 0, NULL, NULL);
+                    canon_flatten(u, NODE_UNION, &n);
+                }
+            body = canon_union_arms(n);
+            if (body->type == NODE_EMPTY) return make_epsilon();
         }
     }
+    return make_node(NODE_STAR, '*', body, NULL);
+}
 
+static RegexNode* canonical_step(RegexNode* node, RegexNode* l, RegexNode* r, void* ctx) {
+    (void)ctx;
+    if (l && l->type != node->type) l = canon_cluster(l);
+    if (r && r->type != node->type) r = canon_cluster(r);
+    if (node->type == NODE_STAR) return canon_star(l);
+    if (l != node->left || r != node->right)
+        node = make_node(node->type, node->symbol, l, r);
     return node;
 }
 
+RegexNode* canonical(RegexNode* node) {
+    return canon_cluster(rewrite(node, canonical_step, NULL));
+}
+
+
+
+// ─────────────────────────────────────────────────────────────────
+// Smart constructors for the transforms
+//
+// With --compact, mk_union/mk_concat/mk_star apply these identities as
+// each node is built, so a transform's result comes out simplified
+// instead of full of ∅, ∅*·s and repeated arms.  Without it they are
+// plain make_node and every transform prints exactly what it always has.
+//   ∅ + s = s + ∅ = s     s + s = s     ∅* + s = s + ∅* = s  if ε ∈ L(s)
+//   ∅·s = s·∅ = ∅         ∅*·s = s·∅* = s     s*·s* = s*
+//   ∅* = (∅*)* = ∅*       (s*)* = s*    (∅* + s)* = (s + ∅*)* = s*
+// Here ∅ stands for any r with L(r) = ∅, which the attrs already know.
+// ─────────────────────────────────────────────────────────────────
+static int compact_mode = 0;
+
+static int lang_empty(RegexNode* n) { return n->attrs & ATTR_EMPTY; }
+
+static RegexNode* mk_union(RegexNode* l, RegexNode* r) {
+    if (compact_mode) {
+        if (lang_empty(l)) return lang_empty(r) ? make_node(NODE_EMPTY, 0, NULL, NULL) : r;
+        if (lang_empty(r) || l == r) return l;
+        if (is_empty_star(l) && (r->attrs & ATTR_EPS)) return r;
+        if (is_empty_star(r) && (l->attrs & ATTR_EPS)) return l;
+    }
+    return make_node(NODE_UNION, '+', l, r);
+}
+
+static RegexNode* mk_concat(RegexNode* l, RegexNode* r) {
+    if (compact_mode) {
+        if (lang_empty(l) || lang_empty(r)) return make_node(NODE_EMPTY, 0, NULL, NULL);
+        if (is_empty_star(l)) return r;
+        if (is_empty_star(r) || (l == r && l->type == NODE_STAR)) return l;
+    }
+    return make_node(NODE_CONCAT, '.', l, r);
+}
+
+static RegexNode* mk_star(RegexNode* s) {
+    if (compact_mode) {
+        if (lang_empty(s)) return make_epsilon();
+        if (s->type == NODE_STAR) return s;
+        if (s->type == NODE_UNION) {
+            if (is_empty_star(s->left))  return mk_star(s->right);
+            if (is_empty_star(s->right)) return mk_star(s->left);
+        }
+    }
+    return make_node(NODE_STAR, '*', s, NULL);
+}
+
+// Size of r as printed: shared subtrees count once per occurrence.
+// Saturates rather than wrapping on exponentially shared DAGs.
+static void tree_size_visit(RegexNode* node, void* ctx) {
+    (void)ctx;
+    unsigned long n = 1;
+    if (node->left) {
+        unsigned long c = node->left->scratch.count;
+        n = c >= ULONG_MAX - n ? ULONG_MAX : n + c;
+    }
+    if (node->right) {
+        unsigned long c = node->right->scratch.count;
+        n = c >= ULONG_MAX - n ? ULONG_MAX : n + c;
+    }
+    node->scratch.count = n;
+}
 
+static unsigned long tree_size(RegexNode* r) {
+    if (!r) return 0;
+    walk_postorder(r, tree_size_visit, NULL);
+    return r->scratch.count;
+}
 
 // ─────────────────────────────────────────────────────────────────
 // Q0: “empty”: is L(r) = ∅ ?
+//
+// These queries read the attributes node_attrs cached at construction.
 // ─────────────────────────────────────────────────────────────────
 int is_empty(RegexNode* node) {
-    if (!node) return 1;
-    switch (node->type) {
-      case NODE_EMPTY:  return 1;
-      case NODE_CHAR:   return 0;
-      case NODE_STAR:   return 0;  // r* always has ε
-      case NODE_UNION:  return is_empty(node->left) && is_empty(node->right);
-      case NODE_CONCAT: return is_empty(node->left) || is_empty(node->right);
-    }
-    return 1;
+    return !node || (node->attrs & ATTR_EMPTY);
 }
 
 // Q1: “has-epsilon”: ε ∈ L(r)?
 int has_epsilon(RegexNode* node) {
-    if (!node) return 0;
-    switch (node->type) {
-      case NODE_EMPTY:  return 0;
-      case NODE_CHAR:   return 0;
-      case NODE_STAR:   return 1;
-      case NODE_UNION:  return has_epsilon(node->left) || has_epsilon(node->right);
-      case NODE_CONCAT: return has_epsilon(node->left) && has_epsilon(node->right);
-    }
-    return 0;
+    return node && (node->attrs & ATTR_EPS);
 }
 
 int has_nonepsilon(RegexNode* node) {
-    if (!node) return 0;
-
-    switch (node->type) {
-        case NODE_EMPTY:
-            return 0;
-        case NODE_CHAR:
-            return 1;
-        case NODE_STAR:
-            return has_nonepsilon(node->left);
-        case NODE_UNION:
-            return has_nonepsilon(node->left) || has_nonepsilon(node->right);
-        case NODE_CONCAT:
-            return
-                (has_nonepsilon(node->left) && !has_epsilon(node->left) && has_epsilon(node->right)) ||
-                (has_nonepsilon(node->right) && !has_epsilon(node->right) && has_epsilon(node->left)) ||
-                (has_nonepsilon(node->left) && has_nonepsilon(node->right));
-    }
-    return 0;
+    return node && (node->attrs & ATTR_NONEPS);
 }
 
 // Q3: “uses a”: ∃ w∈L(r) containing symbol `target` somewhere
 int uses_symbol(RegexNode* node, char target) {
-    if (!node) return 0;
-    switch (node->type) {
-      case NODE_EMPTY:  return 0;
-      case NODE_CHAR:   return node->symbol == target;
-      case NODE_STAR:   return uses_symbol(node->left, target);
-      case NODE_UNION:  return uses_symbol(node->left, target) || uses_symbol(node->right, target);
-      case NODE_CONCAT: {
-        int L = uses_symbol(node->left, target);
-        int R = uses_symbol(node->right, target);
-        int Ln = !is_empty(node->left);
-        int Rn = !is_empty(node->right);
-        return (L && Rn) || (R && Ln);
-      }
-    }
-    return 0;
+    return node && (node->uses & sym_bit(target));
 }
 
 // Q3b: “not-using a”: filter out any occurence of `target`
-RegexNode* not_using(RegexNode* node, char target) {
-    if (!node) return NULL;
+static RegexNode* not_using_step(RegexNode* node, RegexNode* L, RegexNode* R, void* ctx) {
+    char target = *(char*)ctx;
     switch (node->type) {
       case NODE_EMPTY:
         return make_node(NODE_EMPTY, 0, NULL, NULL);
@@ -249,64 +1046,60 @@ RegexNode* not_using(RegexNode* node, char target) {
         if (node->symbol == target)
             return make_node(NODE_EMPTY, 0, NULL, NULL);
         return make_node(NODE_CHAR, node->symbol, NULL, NULL);
-      case NODE_UNION: {
-        RegexNode* L = not_using(node->left,  target);
-        RegexNode* R = not_using(node->right, target);
-        if (is_empty(L) && is_empty(R)) {
-            free_tree(L); free_tree(R);
+      case NODE_UNION:
+        if (is_empty(L) && is_empty(R))
             return make_node(NODE_EMPTY,0,NULL,NULL);
-        }
-        if (is_empty(L)) {
-            free_tree(L);
-            return R;
-        }
-        if (is_empty(R)) {
-            free_tree(R);
-            return L;
-        }
-        return make_node(NODE_UNION, '+', L, R);
-      }
-      case NODE_CONCAT: {
-        RegexNode* L = not_using(node->left,  target);
-        RegexNode* R = not_using(node->right, target);
-        if (is_empty(L) || is_empty(R)) {
-            free_tree(L); free_tree(R);
+        if (is_empty(L)) return R;
+        if (is_empty(R)) return L;
+        return mk_union(L, R);
+      case NODE_CONCAT:
+        if (is_empty(L) || is_empty(R))
             return make_node(NODE_EMPTY,0,NULL,NULL);
-        }
-        return make_node(NODE_CONCAT, '.', L, R);
-      }
-      case NODE_STAR: {
-        RegexNode* C = not_using(node->left, target);
-        return make_node(NODE_STAR, '*', C, NULL);
-      }
+        return mk_concat(L, R);
+      case NODE_STAR:
+        return mk_star(L);
     }
     return NULL;
 }
 
-int is_infinite(RegexNode* node) {
-    if (!node) return 0;
-    switch (node->type) {
-        case NODE_EMPTY:
-        case NODE_CHAR:
-            return 0;
-        case NODE_UNION:
-            return is_infinite(node->left)  || is_infinite(node->right);
-        case NODE_CONCAT:
-            return (is_infinite(node->left) && !is_empty(node->right)) ||
-                   (is_infinite(node->right) && !is_empty(node->left));
-        
-        case NODE_STAR:
-            // star is infinite iff its body can produce some non-empty string
-            return has_nonepsilon(node->left);
+// Without an empty subterm every symbol in r is live, so if target is
+// not live the rewrite would rebuild r node for node; skip it.  --compact
+// may still simplify, so it always rewrites.
+RegexNode* not_using(RegexNode* node, char target) {
+    if (node && !compact_mode && !(node->attrs & ATTR_EMPTY_SUB)
+        && !uses_symbol(node, target))
+        return node;
+    return rewrite(node, not_using_step, &target);
+}
+
+// --alphabet: the symbols of r as two masks, bit i for sym_index i.
+// Live symbols are the cached uses set; dead ones occur in r but in no
+// string of L(r), and take one walk to find.
+static void mentions_visit(RegexNode* node, void* ctx) {
+    if (node->type == NODE_CHAR) *(SymSet*)ctx |= sym_bit(node->symbol);
+}
+
+static void print_alphabet(RegexNode* tree) {
+    SymSet live = tree->uses, dead = 0;
+    if (tree->attrs & ATTR_EMPTY_SUB) {
+        walk_postorder(tree, mentions_visit, &dead);
+        dead &= ~live;
     }
-    return 0;
+    char buf[48];
+    snprintf(buf, sizeof buf, "%016llx\t%016llx\n",
+             (unsigned long long)live, (unsigned long long)dead);
+    out_str(out, buf);
+}
+
+int is_infinite(RegexNode* node) {
+    return node && (node->attrs & ATTR_INFINITE);
 }
 
 // ─────────────────────────────────────────────────────────────────
-// Q5: “starts-with a” via Brzozowski derivative
+// Brzozowski derivative: D(a, r) = { w : aw ∈ L(r) }
 // ─────────────────────────────────────────────────────────────────
-RegexNode* derivative(RegexNode* r, char a) {
-    if (!r) return make_node(NODE_EMPTY,0,NULL,NULL);
+static RegexNode* derivative_step(RegexNode* r, RegexNode* Dleft, RegexNode* Dright, void* ctx) {
+    char a = *(char*)ctx;
     switch (r->type) {
       case NODE_EMPTY:
         return make_node(NODE_EMPTY,0,NULL,NULL);
@@ -314,72 +1107,124 @@ RegexNode* derivative(RegexNode* r, char a) {
         return (r->symbol == a)
             ? make_epsilon()
             : make_node(NODE_EMPTY,0,NULL,NULL);
-      case NODE_UNION: {
-        RegexNode* L = derivative(r->left,  a);
-        RegexNode* R = derivative(r->right, a);
-        return make_node(NODE_UNION,'+',L,R);
-      }
+      case NODE_UNION:
+        return mk_union(Dleft,Dright);
       case NODE_CONCAT: {
         // D(a, st) = D(a,s)·t  [ + (if ε∈s) D(a,t) ]
-        RegexNode* Dleft = derivative(r->left,a);
-        RegexNode* leftCat = make_node(NODE_CONCAT,'.',Dleft,clone_tree(r->right));
-        if (has_epsilon(r->left)) {
-            RegexNode* Dright = derivative(r->right,a);
-            return make_node(NODE_UNION,'+',leftCat,Dright);
-        }
+        RegexNode* leftCat = mk_concat(Dleft,clone_tree(r->right));
+        if (has_epsilon(r->left))
+            return mk_union(leftCat,Dright);
         return leftCat;
       }
-      case NODE_STAR: {
+      case NODE_STAR:
         // D(a, s*) = D(a,s)·s*
-        RegexNode* Ds = derivative(r->left,a);
-        return make_node(NODE_CONCAT,'.', Ds, clone_tree(r));
-      }
+        return mk_concat(Dleft, clone_tree(r));
     }
     return make_node(NODE_EMPTY,0,NULL,NULL);
 }
 
-int starts_with(RegexNode* r, char a) {
-    RegexNode* d = derivative(r, a);
-    int ans = !is_empty(d);
-    free_tree(d);
-    return ans;
+RegexNode* derivative(RegexNode* r, char a) {
+    if (!r) return make_node(NODE_EMPTY,0,NULL,NULL);
+    return rewrite(r, derivative_step, &a);
 }
 
-RegexNode* reverse_regex(RegexNode* node) {
-    if (!node) return NULL;
-
+static RegexNode* reverse_step(RegexNode* node, RegexNode* left, RegexNode* right, void* ctx) {
+    (void)ctx;
     switch (node->type) {
         case NODE_EMPTY:
             return make_node(NODE_EMPTY, 0, NULL, NULL);
         case NODE_CHAR:
             return make_node(NODE_CHAR, node->symbol, NULL, NULL);
-        case NODE_STAR: {
-            RegexNode* inner = reverse_regex(node->left);
-            return make_node(NODE_STAR, '*', inner, NULL);
-        }
-        case NODE_UNION: {
-            RegexNode* left = reverse_regex(node->left);
-            RegexNode* right = reverse_regex(node->right);
-            return make_node(NODE_UNION, '+', left, right);
-        }
-        case NODE_CONCAT: {
-            RegexNode* left = reverse_regex(node->left);
-            RegexNode* right = reverse_regex(node->right);
-            return make_node(NODE_CONCAT, '.', right, left);  // 🔁 swapped
-        }
+        case NODE_STAR:
+            return mk_star(left);
+        case NODE_UNION:
+            return mk_union(left, right);
+        case NODE_CONCAT:
+            return mk_concat(right, left);  // 🔁 swapped
     }
     return NULL;
 }
 
-int ends_with(RegexNode* node, char target) {
-    RegexNode* rev = reverse_regex(node);
-    int result = starts_with(rev, target);
-    free_tree(rev);
-    return result;
+RegexNode* reverse_regex(RegexNode* node) {
+    return rewrite(node, reverse_step, NULL);
 }
 
-RegexNode* prefixes(RegexNode* r) {
-    if (!r) return make_node(NODE_EMPTY, 0, NULL, NULL);
+// ─────────────────────────────────────────────────────────────────
+// Multi-query analysis: every boolean answer in one traversal
+//
+// analyze() gathers the same answers as is_empty, has_epsilon,
+// has_nonepsilon, is_infinite, and -- as symbol sets -- uses_symbol,
+// starts_with and ends_with for every symbol.  The first four and the
+// uses set are cached on the root; only FIRST/LAST need the walk.
+// ─────────────────────────────────────────────────────────────────
+typedef struct Attrs {
+    int    empty, eps, noneps, infinite;
+    SymSet uses, first, last;
+} Attrs;
+
+// FIRST and LAST symbol sets: a ∈ first iff starts_with(r, a),
+// a ∈ last iff ends_with(r, a).
+static void first_last_visit(RegexNode* node, void* ctx) {
+    (void)ctx;
+    RegexNode* l = node->left;
+    RegexNode* r = node->right;
+    SymSet first = 0, last = 0;
+    switch (node->type) {
+      case NODE_EMPTY:
+        break;
+      case NODE_CHAR:
+        first = last = sym_bit(node->symbol);
+        break;
+      case NODE_STAR:
+        first = l->scratch.sets.first;
+        last  = l->scratch.sets.last;
+        break;
+      case NODE_UNION:
+        first = l->scratch.sets.first | r->scratch.sets.first;
+        last  = l->scratch.sets.last  | r->scratch.sets.last;
+        break;
+      case NODE_CONCAT:
+        first = (is_empty(r) ? 0 : l->scratch.sets.first) | (has_epsilon(l) ? r->scratch.sets.first : 0);
+        last  = (is_empty(l) ? 0 : r->scratch.sets.last)  | (has_epsilon(r) ? l->scratch.sets.last  : 0);
+        break;
+    }
+    node->scratch.sets.first = first;
+    node->scratch.sets.last  = last;
+}
+
+static void first_last(RegexNode* node, SymSet* first, SymSet* last) {
+    *first = *last = 0;
+    if (!node) return;
+    walk_postorder(node, first_last_visit, NULL);
+    *first = node->scratch.sets.first;
+    *last  = node->scratch.sets.last;
+}
+
+// Q5: “starts-with a” and Q6: “ends-with a”, as bit tests on FIRST and
+// LAST: no derivative or reversed copy is built.
+int starts_with(RegexNode* r, char a) {
+    SymSet first, last;
+    first_last(r, &first, &last);
+    return (first & sym_bit(a)) != 0;
+}
+
+int ends_with(RegexNode* r, char a) {
+    SymSet first, last;
+    first_last(r, &first, &last);
+    return (last & sym_bit(a)) != 0;
+}
+
+void analyze(RegexNode* node, Attrs* a) {
+    a->empty    = is_empty(node);
+    a->eps      = has_epsilon(node);
+    a->noneps   = has_nonepsilon(node);
+    a->infinite = is_infinite(node);
+    a->uses     = node ? node->uses : 0;
+    first_last(node, &a->first, &a->last);
+}
+
+static RegexNode* prefixes_step(RegexNode* r, RegexNode* Ps, RegexNode* Pt, void* ctx) {
+    (void)ctx;
     switch (r->type) {
       case NODE_EMPTY:
         // prefixes(∅) = ∅
@@ -389,15 +1234,12 @@ RegexNode* prefixes(RegexNode* r) {
         // prefixes(c) = c + ∅*
         RegexNode* charN = make_node(NODE_CHAR, r->symbol, NULL, NULL);
         RegexNode* epsN  = make_epsilon();
-        return make_node(NODE_UNION, '+', charN, epsN);
+        return mk_union(charN, epsN);
       }
 
-      case NODE_UNION: {
+      case NODE_UNION:
         // prefixes(s + t) = prefixes(s) + prefixes(t)
-        RegexNode* L = prefixes(r->left);
-        RegexNode* R = prefixes(r->right);
-        return make_node(NODE_UNION, '+', L, R);
-      }
+        return mk_union(Ps, Pt);
 
       case NODE_CONCAT: {
         // prefixes(st) = ∅      if L(t)=∅
@@ -405,36 +1247,30 @@ RegexNode* prefixes(RegexNode* r) {
         if (is_empty(r->right)) {
           return make_node(NODE_EMPTY, 0, NULL, NULL);
         } else {
-          RegexNode* Ps = prefixes(r->left);
-          RegexNode* Pt = prefixes(r->right);
-          // clone s to build s·prefixes(t)
-          RegexNode* sClone = clone_tree(r->left);
-          RegexNode* sPt    = make_node(NODE_CONCAT, '.', sClone, Pt);
-          return make_node(NODE_UNION, '+', Ps, sPt);
+          RegexNode* sPt = mk_concat(clone_tree(r->left), Pt);
+          return mk_union(Ps, sPt);
         }
       }
 
-      case NODE_STAR: {
+      case NODE_STAR:
         // prefixes(s*) = ∅*      if L(s)=∅
         //                s* · prefixes(s)   otherwise
-        if (is_empty(r->left)) {
+        if (is_empty(r->left))
           return make_epsilon();
-        } else {
-          // clone the whole star
-          RegexNode* starClone = clone_tree(r);
-          RegexNode* Ps        = prefixes(r->left);
-          return make_node(NODE_CONCAT, '.', starClone, Ps);
-        }
-      }
+        return mk_concat(clone_tree(r), Ps);
     }
-    
+
     return make_node(NODE_EMPTY, 0, NULL, NULL);
 }
 
-RegexNode *insert_sym(RegexNode *r, char a_sym)
+RegexNode* prefixes(RegexNode* r) {
+    if (!r) return make_node(NODE_EMPTY, 0, NULL, NULL);
+    return rewrite(r, prefixes_step, NULL);
+}
+
+static RegexNode *insert_sym_step(RegexNode *r, RegexNode *L, RegexNode *R, void *ctx)
 {
-    if (!r)                           /* defensive */
-        return make_node(NODE_EMPTY,0,NULL,NULL);
+    char a_sym = *(char *)ctx;
 
     switch (r->type) {
 
@@ -443,36 +1279,25 @@ RegexNode *insert_sym(RegexNode *r, char a_sym)
         return make_node(NODE_EMPTY,0,NULL,NULL);
 
     case NODE_CHAR: {                 /* c → ac + ca */
-        RegexNode *ac = make_node(NODE_CONCAT,'.',
-                          make_node(NODE_CHAR,a_sym,NULL,NULL),
-                          make_node(NODE_CHAR,r->symbol,NULL,NULL));
+        RegexNode *ac = mk_concat(make_node(NODE_CHAR,a_sym,NULL,NULL),
+                                  make_node(NODE_CHAR,r->symbol,NULL,NULL));
 
-        RegexNode *ca = make_node(NODE_CONCAT,'.',
-                          make_node(NODE_CHAR,r->symbol,NULL,NULL),
-                          make_node(NODE_CHAR,a_sym,NULL,NULL));
+        RegexNode *ca = mk_concat(make_node(NODE_CHAR,r->symbol,NULL,NULL),
+                                  make_node(NODE_CHAR,a_sym,NULL,NULL));
 
-        return make_node(NODE_UNION,'+',ac,ca);
+        return mk_union(ac,ca);
     }
 
     /* ----------- union ----------- */
-    case NODE_UNION: {
-        RegexNode *L = insert_sym(r->left , a_sym);
-        RegexNode *R = insert_sym(r->right, a_sym);
-        return make_node(NODE_UNION,'+', L, R);
-    }
+    case NODE_UNION:
+        return mk_union(L, R);
 
     /* ----------- concatenation ----------- */
     case NODE_CONCAT: {
         /* insert(s)·t  +  s·insert(t) */
-        RegexNode *leftPart  = make_node(NODE_CONCAT,'.',
-                               insert_sym(r->left, a_sym),
-                               clone_tree(r->right));
-
-        RegexNode *rightPart = make_node(NODE_CONCAT,'.',
-                               clone_tree(r->left),
-                               insert_sym(r->right, a_sym));
-
-        return make_node(NODE_UNION,'+', leftPart, rightPart);
+        RegexNode *leftPart  = mk_concat(L, clone_tree(r->right));
+        RegexNode *rightPart = mk_concat(clone_tree(r->left), R);
+        return mk_union(leftPart, rightPart);
     }
 
     /* ----------- star ----------- */
@@ -480,13 +1305,11 @@ RegexNode *insert_sym(RegexNode *r, char a_sym)
         /* a  +  s*·insert(s)·s* */
         RegexNode *singleA = make_node(NODE_CHAR, a_sym, NULL, NULL);
 
-        RegexNode *concat  = make_node(NODE_CONCAT,'.',
-                               clone_tree(r),         /* s* (left)  */
-                               make_node(NODE_CONCAT,'.',
-                                   insert_sym(r->left, a_sym),
-                                   clone_tree(r)));   /* ... s* (right) */
+        RegexNode *concat  = mk_concat(clone_tree(r),         /* s* (left)  */
+                                       mk_concat(L,
+                                           clone_tree(r)));   /* ... s* (right) */
 
-        return make_node(NODE_UNION,'+', singleA, concat);
+        return mk_union(singleA, concat);
     }
     }
 
@@ -494,9 +1317,15 @@ RegexNode *insert_sym(RegexNode *r, char a_sym)
     return make_node(NODE_EMPTY,0,NULL,NULL);
 }
 
-RegexNode* bs_for_a(RegexNode* node) {
-    if (!node) return NULL;
+RegexNode *insert_sym(RegexNode *r, char a_sym)
+{
+    if (!r)                           /* defensive */
+        return make_node(NODE_EMPTY,0,NULL,NULL);
+    return rewrite(r, insert_sym_step, &a_sym);
+}
 
+static RegexNode* bs_for_a_step(RegexNode* node, RegexNode* L, RegexNode* R, void* ctx) {
+    (void)ctx;
     switch (node->type) {
         case NODE_EMPTY:
             return make_node(NODE_EMPTY, 0, NULL, NULL);
@@ -504,35 +1333,28 @@ RegexNode* bs_for_a(RegexNode* node) {
             if (node->symbol == 'a') {
                 // replace 'a' with b* (i.e., zero or more b's)
                 RegexNode* b = make_node(NODE_CHAR, 'b', NULL, NULL);
-                return make_node(NODE_STAR, '*', b, NULL);
+                return mk_star(b);
             } else {
                 return make_node(NODE_CHAR, node->symbol, NULL, NULL);
             }
-        case NODE_UNION: {
-            RegexNode* L = bs_for_a(node->left);
-            RegexNode* R = bs_for_a(node->right);
-            return make_node(NODE_UNION, '+', L, R);
-        }
-        case NODE_CONCAT: {
-            RegexNode* L = bs_for_a(node->left);
-            RegexNode* R = bs_for_a(node->right);
-            return make_node(NODE_CONCAT, '.', L, R);
-        }
-        case NODE_STAR: {
-            RegexNode* body = bs_for_a(node->left);
-            return make_node(NODE_STAR, '*', body, NULL);
-        }
+        case NODE_UNION:
+            return mk_union(L, R);
+        case NODE_CONCAT:
+            return mk_concat(L, R);
+        case NODE_STAR:
+            return mk_star(L);
     }
     return NULL;
 }
 
+RegexNode* bs_for_a(RegexNode* node) {
+    return rewrite(node, bs_for_a_step, NULL);
+}
+
 
 // Returns a new tree for r′ = strip off an initial 'a' from all strings in L(r)
-RegexNode* strip_symbol(RegexNode* r, char a) {
-    if (!r) {
-        // ∅ → ∅
-        return make_node(NODE_EMPTY, 0, NULL, NULL);
-    }
+static RegexNode* strip_step(RegexNode* r, RegexNode* sp, RegexNode* tp, void* ctx) {
+    char a = *(char*)ctx;
     switch (r->type) {
       case NODE_EMPTY:
         // ∅ → ∅
@@ -547,59 +1369,44 @@ RegexNode* strip_symbol(RegexNode* r, char a) {
             return make_node(NODE_EMPTY, 0, NULL, NULL);
         }
 
-      case NODE_UNION: {
+      case NODE_UNION:
         // (s + t) → strip(s) + strip(t)
-        RegexNode* Lp = strip_symbol(r->left,  a);
-        RegexNode* Rp = strip_symbol(r->right, a);
-        return make_node(NODE_UNION, '+', Lp, Rp);
-      }
+        return mk_union(sp, tp);
 
       case NODE_CONCAT: {
         // st → if ε∈L(s)
         //          then strip(s)·t  +  strip(t)
         //          else strip(s)·t
-        RegexNode* sp = strip_symbol(r->left,  a);
-        RegexNode* tp = strip_symbol(r->right, a);
-
-        if (has_epsilon(r->left)) {
-            // build (strip(s)·t)
-            RegexNode* leftCat = make_node(
-              NODE_CONCAT, '.',
-              sp,
-              clone_tree(r->right)
-            );
-            // then union it with strip(t)
-            return make_node(NODE_UNION, '+', leftCat, tp);
-        } else {
-            // just strip(s)·t
-            return make_node(
-              NODE_CONCAT, '.',
-              sp,
-              clone_tree(r->right)
-            );
-        }
+        RegexNode* leftCat = mk_concat(sp, clone_tree(r->right));
+        if (has_epsilon(r->left))
+            return mk_union(leftCat, tp);
+        return leftCat;
       }
 
-      case NODE_STAR: {
+      case NODE_STAR:
         // s* → strip(s)·s*
-        RegexNode* sp = strip_symbol(r->left, a);
-        RegexNode* starClone = clone_tree(r);
-        return make_node(NODE_CONCAT, '.', sp, starClone);
-      }
+        return mk_concat(sp, clone_tree(r));
     }
 
     // fallback (shouldn't happen)
     return make_node(NODE_EMPTY, 0, NULL, NULL);
 }
 
+RegexNode* strip_symbol(RegexNode* r, char a) {
+    if (!r) {
+        // ∅ → ∅
+        return make_node(NODE_EMPTY, 0, NULL, NULL);
+    }
+    return rewrite(r, strip_step, &a);
+}
+
 /* ====================================================================== */
 /*  Insert exactly one copy of the symbol `a` somewhere in every string
     of L(r).  Return a new syntax tree (caller owns it).                  */
 /* ====================================================================== */
-RegexNode *insert_symbol(RegexNode *r, char a)
+static RegexNode *insert_step(RegexNode *r, RegexNode *Is, RegexNode *It, void *ctx)
 {
-    if (!r)                                   /* should not happen            */
-        return make_node(NODE_EMPTY, 0, NULL, NULL);
+    char a = *(char *)ctx;
 
     switch (r->type)
     {
@@ -610,27 +1417,22 @@ RegexNode *insert_symbol(RegexNode *r, char a)
         return make_node(NODE_EMPTY, 0, NULL, NULL);
 
     case NODE_CHAR: {                         /* c → a·c  +  c·a             */
-        RegexNode *left  = make_node(
-            NODE_CONCAT, '.',
+        RegexNode *left  = mk_concat(
             make_node(NODE_CHAR, a,             NULL, NULL),
             make_node(NODE_CHAR, r->symbol,     NULL, NULL));
 
-        RegexNode *right = make_node(
-            NODE_CONCAT, '.',
+        RegexNode *right = mk_concat(
             make_node(NODE_CHAR, r->symbol,     NULL, NULL),
             make_node(NODE_CHAR, a,             NULL, NULL));
 
-        return make_node(NODE_UNION, '+', left, right);
+        return mk_union(left, right);
     }
 
 /* ---------------------------------------------------------------------- */
 /*  union:  (s + t) → insert(s) + insert(t)                               */
 /* ---------------------------------------------------------------------- */
     case NODE_UNION:
-        return make_node(
-            NODE_UNION, '+',
-            insert_symbol(r->left,  a),
-            insert_symbol(r->right, a));
+        return mk_union(Is, It);
 
 /* ---------------------------------------------------------------------- */
 /*  concatenation:                                                        */
@@ -638,17 +1440,9 @@ RegexNode *insert_symbol(RegexNode *r, char a)
 /*  (the older piece – insert(s)·t – is placed first)                     */
 /* ---------------------------------------------------------------------- */
     case NODE_CONCAT: {
-        RegexNode *leftTerm = make_node(
-            NODE_CONCAT, '.',
-            insert_symbol(r->left, a),
-            clone_tree(r->right));
-
-        RegexNode *rightTerm = make_node(
-            NODE_CONCAT, '.',
-            clone_tree(r->left),
-            insert_symbol(r->right, a));
-
-        return make_node(NODE_UNION, '+', leftTerm, rightTerm);
+        RegexNode *leftTerm  = mk_concat(Is, clone_tree(r->right));
+        RegexNode *rightTerm = mk_concat(clone_tree(r->left), It);
+        return mk_union(leftTerm, rightTerm);
     }
 
 /* ---------------------------------------------------------------------- */
@@ -658,22 +1452,18 @@ RegexNode *insert_symbol(RegexNode *r, char a)
 /* ---------------------------------------------------------------------- */
     case NODE_STAR: {
         /* between copies: s*·a·s* */
-        RegexNode *between = make_node(
-            NODE_CONCAT, '.',
+        RegexNode *between = mk_concat(
             clone_tree(r),
-            make_node(NODE_CONCAT, '.',
+            mk_concat(
                 make_node(NODE_CHAR, a, NULL, NULL),
                 clone_tree(r)));
 
         /* inside one copy: s*·insert(s)·s* */
-        RegexNode *inside  = make_node(
-            NODE_CONCAT, '.',
+        RegexNode *inside  = mk_concat(
             clone_tree(r),
-            make_node(NODE_CONCAT, '.',
-                insert_symbol(r->left, a),
-                clone_tree(r)));
+            mk_concat(Is, clone_tree(r)));
 
-        return make_node(NODE_UNION, '+', between, inside);
+        return mk_union(between, inside);
     }
     }
 
@@ -681,147 +1471,2893 @@ RegexNode *insert_symbol(RegexNode *r, char a)
     return make_node(NODE_EMPTY, 0, NULL, NULL);
 }
 
+RegexNode *insert_symbol(RegexNode *r, char a)
+{
+    if (!r)                                   /* should not happen            */
+        return make_node(NODE_EMPTY, 0, NULL, NULL);
+    return rewrite(r, insert_step, &a);
+}
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s --<option> [symbol]\n", argv[0]);
-        return 1;
+// ─────────────────────────────────────────────────────────────────
+// Quotients by a word or a regex, through derivative automata
+//
+// The states are canonical regexes (as for --match), so each step costs
+// the size of a state, not the size of a tree that --strip has cloned
+// k times.  A state already is a regex, so the answer needs no
+// automaton-to-regex conversion.  Right quotients reverse both sides.
+// ─────────────────────────────────────────────────────────────────
+
+// w⁻¹r: the state reached from r along w.
+RegexNode* strip_word(RegexNode* r, const char* w, size_t len) {
+    r = canonical(r);
+    for (size_t i = 0; i < len && !is_empty(r); i++)
+        r = canonical(derivative(r, w[i]));
+    return r;
+}
+
+static _Thread_local RegexNode** quot_a = NULL;     // pairs seen, in BFS order
+static _Thread_local RegexNode** quot_b = NULL;
+static _Thread_local size_t      quot_n = 0, quot_cap = 0;
+static _Thread_local int*        quot_map = NULL;   // pair → index, linear probing
+static _Thread_local size_t      quot_map_cap = 0;
+
+static size_t quot_slot(RegexNode* a, RegexNode* b) {
+    size_t i = (a->hash * 31 + b->hash) & (quot_map_cap - 1);
+    while (quot_map[i] != -1 && (quot_a[quot_map[i]] != a || quot_b[quot_map[i]] != b))
+        i = (i + 1) & (quot_map_cap - 1);
+    return i;
+}
+
+static void quot_add(RegexNode* a, RegexNode* b) {
+    if (2 * (quot_n + 1) > quot_map_cap) {
+        quot_map_cap = quot_map_cap ? quot_map_cap * 2 : 256;
+        free(quot_map);
+        quot_map = xmalloc(quot_map_cap * sizeof *quot_map);
+        memset(quot_map, 0xff, quot_map_cap * sizeof *quot_map);
+        for (size_t k = 0; k < quot_n; k++)
+            quot_map[quot_slot(quot_a[k], quot_b[k])] = (int)k;
     }
-    // Determine mode
-    int noop_mode        = strcmp(argv[1], "--no-op")        == 0;
-    int simplify_mode    = strcmp(argv[1], "--simplify")     == 0;
-    int empty_mode       = strcmp(argv[1], "--empty")        == 0;
-    int eps_mode         = strcmp(argv[1], "--has-epsilon")  == 0;
-    int noneps_mode      = strcmp(argv[1], "--has-nonepsilon")== 0;
-    int uses_mode        = strcmp(argv[1], "--uses")         == 0;
-    int notusing_mode    = strcmp(argv[1], "--not-using")    == 0;
-    int infinite_mode    = strcmp(argv[1], "--infinite")     == 0;
-    int startswith_mode  = strcmp(argv[1], "--starts-with")  == 0;
-    int reverse_mode     = strcmp(argv[1], "--reverse")      == 0;
-    int endswith_mode    = strcmp(argv[1], "--ends-with")    == 0;
-    int prefixes_mode    = strcmp(argv[1], "--prefixes")     == 0;
-    int bsfora_mode      = strcmp(argv[1], "--bs-for-a")     == 0;
-    int insert_mode      = strcmp(argv[1], "--insert")       == 0;
-    int strip_mode       = strcmp(argv[1], "--strip")        == 0;
-    char sym = 0;
-    if (uses_mode|| notusing_mode || startswith_mode || endswith_mode || strip_mode || insert_mode) {
-        if (argc<3 || strlen(argv[2])!=1) {
-            fprintf(stderr,"Error: %s requires one symbol argument\n",argv[1]);
-            return 1;
+    size_t i = quot_slot(a, b);
+    if (quot_map[i] != -1) return;
+    if (quot_n == quot_cap) {
+        quot_cap = quot_cap ? quot_cap * 2 : 256;
+        quot_a = xrealloc(quot_a, quot_cap * sizeof *quot_a);
+        quot_b = xrealloc(quot_b, quot_cap * sizeof *quot_b);
+    }
+    quot_a[quot_n] = a;
+    quot_b[quot_n] = b;
+    quot_map[i] = (int)quot_n++;
+}
+
+// r2⁻¹r = { v : uv ∈ L(r) for some u ∈ L(r2) }.  Breadth-first over the
+// product of the two automata from (r2, r); the pairs whose first half
+// accepts contribute their second half to the union.
+RegexNode* left_quotient(RegexNode* r, RegexNode* r2) {
+    RegexNode* result = make_node(NODE_EMPTY, 0, NULL, NULL);
+    quot_add(canonical(r2), canonical(r));
+    for (size_t k = 0; k < quot_n; k++) {
+        RegexNode* a = quot_a[k];
+        RegexNode* b = quot_b[k];
+        if (is_empty(a) || is_empty(b)) continue;
+        if (has_epsilon(a)) result = make_node(NODE_UNION, '+', result, b);
+        for (SymSet m = a->uses & b->uses; m; m &= m - 1) {
+            char c = index_sym(__builtin_ctzll(m));
+            quot_add(canonical(derivative(a, c)), canonical(derivative(b, c)));
         }
-        sym = argv[2][0];
     }
+    // Forget the pairs newest first, as dfa_reset does.
+    while (quot_n) {
+        quot_n--;
+        quot_map[quot_slot(quot_a[quot_n], quot_b[quot_n])] = -1;
+    }
+    return canonical(result);
+}
 
-    char line[1024];
-    while (fgets(line, sizeof line, stdin)) {
-        RegexNode* tree = parse_postfix(line);
-        if (!tree) continue;
+RegexNode* right_strip_word(RegexNode* r, const char* w, size_t len) {
+    RegexNode* q = canonical(reverse_regex(r));
+    for (size_t i = len; i > 0 && !is_empty(q); i--)
+        q = canonical(derivative(q, w[i - 1]));
+    return canonical(reverse_regex(q));
+}
 
-        if (empty_mode) {
-            printf(is_empty(tree) ? "yes\n":"no\n");
-            free_tree(tree);
-            continue;
-        }
-        if (eps_mode) {
-            printf(has_epsilon(tree) ? "yes\n":"no\n");
-            free_tree(tree);
-            continue;
-        }
-        if (noneps_mode) {
-            printf(has_nonepsilon(tree) ? "yes\n":"no\n");
-            free_tree(tree);
-            continue;
+RegexNode* right_quotient(RegexNode* r, RegexNode* r2) {
+    return canonical(reverse_regex(left_quotient(reverse_regex(r), reverse_regex(r2))));
+}
+
+
+// ─────────────────────────────────────────────────────────────────
+// Input: whole lines of any length
+//
+// A regular file is mmap'd and every line is handed to the callback in
+// place, with no copy.  Anything else (a pipe or terminal) is read in
+// large blocks into a buffer that doubles whenever a single line does
+// not fit.  Lines are passed without their trailing newline.
+// ─────────────────────────────────────────────────────────────────
+#define READ_BLOCK (1 << 20)
+
+typedef void (*LineFn)(const char* line, size_t len);
+
+// Call fn on each complete line in buf[0..len); return bytes consumed.
+static size_t split_lines(const char* buf, size_t len, size_t scan_from, LineFn fn) {
+    size_t start = 0;
+    const char* nl;
+    while (scan_from < len
+           && (nl = memchr(buf + scan_from, '\n', len - scan_from)) != NULL) {
+        size_t end = (size_t)(nl - buf);
+        fn(buf + start, end - start);
+        start = scan_from = end + 1;
+    }
+    return start;
+}
+
+static void read_lines(int fd, LineFn fn) {
+    struct stat st;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > pos) {
+        // Start where the file offset is (someone may have read part of
+        // it already): map from the page holding it and skip the slack.
+        off_t base = pos & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+        size_t size = (size_t)(st.st_size - base), skip = (size_t)(pos - base);
+        char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, base);
+        if (map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+            size_t done = skip + split_lines(map + skip, size - skip, 0, fn);
+            if (done < size) fn(map + done, size - done);
+            munmap(map, size);
+            lseek(fd, st.st_size, SEEK_SET);    // consumed, as read(2) would leave it
+            return;
         }
-        if (simplify_mode) {
-            RegexNode* prev;
-            do {
-                prev = tree;
-                tree = simplify(tree);
-            } while (!trees_equal(tree, prev));
-            print_prefix(tree);
-            printf("\n");
-            free_tree(tree);
-            continue;
+    }
+
+    size_t cap = READ_BLOCK, len = 0, scanned = 0;
+    char* buf = xmalloc(cap);
+    for (;;) {
+        if (len == cap) {
+            cap *= 2;
+            buf = xrealloc(buf, cap);
         }
-        if (uses_mode) {
-            printf(uses_symbol(tree,sym) ? "yes\n":"no\n");
-            free_tree(tree);
-            continue;
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += (size_t)n;
+        size_t done = split_lines(buf, len, scanned, fn);
+        if (done > 0) {
+            memmove(buf, buf + done, len - done);
+            len -= done;
+            scanned = len;
+        } else {
+            scanned = len;      // no newline yet: don't rescan these bytes
         }
-        if (notusing_mode) {
-            RegexNode* filt = not_using(tree,sym);
-            print_prefix(filt);
-            printf("\n");
-            free_tree(tree);
-            free_tree(filt);
+    }
+    if (len > 0) fn(buf, len);
+    free(buf);
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --match FILE: membership through a lazily built derivative DFA
+//
+// A DFA state is a regex in canonical form, so derivatives that differ
+// only by ACI of + or by ∅/∅* clutter are the same state, and by
+// Brzozowski there are finitely many.  A transition is computed the
+// first time some string needs it; from then on each byte costs one
+// table lookup.  The tables are per thread and reused across lines.
+// ─────────────────────────────────────────────────────────────────
+#define DFA_UNKNOWN (-1)
+
+static _Thread_local RegexNode**    dfa_state  = NULL;  // state id → regex
+static _Thread_local int*           dfa_next   = NULL;  // [id * 256 + byte]
+static _Thread_local unsigned char* dfa_accept = NULL;
+static _Thread_local size_t         dfa_nstates = 0, dfa_cap = 0;
+static _Thread_local int*           dfa_map    = NULL;  // regex → id, linear probing
+static _Thread_local size_t         dfa_map_cap = 0;
+static _Thread_local int            dfa_dead = DFA_UNKNOWN;  // the ∅ state, once seen
+
+static int dfa_lookup(RegexNode* r, size_t* slot) {
+    size_t i = r->hash & (dfa_map_cap - 1);
+    while (dfa_map[i] != DFA_UNKNOWN && dfa_state[dfa_map[i]] != r)
+        i = (i + 1) & (dfa_map_cap - 1);
+    *slot = i;
+    return dfa_map[i];
+}
+
+static void dfa_map_grow(void) {
+    size_t n = dfa_map_cap ? dfa_map_cap * 2 : 1024;
+    free(dfa_map);
+    dfa_map = xmalloc(n * sizeof *dfa_map);
+    memset(dfa_map, 0xff, n * sizeof *dfa_map);
+    dfa_map_cap = n;
+    for (size_t id = 0; id < dfa_nstates; id++) {
+        size_t slot;
+        dfa_lookup(dfa_state[id], &slot);
+        dfa_map[slot] = (int)id;
+    }
+}
+
+// The state for canonical regex r, added if new.
+static int dfa_intern(RegexNode* r) {
+    size_t slot;
+    if (2 * (dfa_nstates + 1) > dfa_map_cap) dfa_map_grow();
+    int id = dfa_lookup(r, &slot);
+    if (id != DFA_UNKNOWN) return id;
+    if (dfa_nstates == dfa_cap) {
+        dfa_cap = dfa_cap ? dfa_cap * 2 : 64;
+        dfa_state  = xrealloc(dfa_state,  dfa_cap * sizeof *dfa_state);
+        dfa_accept = xrealloc(dfa_accept, dfa_cap);
+        dfa_next   = xrealloc(dfa_next,   dfa_cap * 256 * sizeof *dfa_next);
+    }
+    id = (int)dfa_nstates++;
+    dfa_state[id]  = r;
+    dfa_accept[id] = has_epsilon(r) != 0;
+    dfa_map[slot]  = id;
+    if (is_empty(r)) {                  // dead state: loops on every byte
+        for (int b = 0; b < 256; b++) dfa_next[(size_t)id * 256 + b] = id;
+        dfa_dead = id;
+    } else {
+        memset(dfa_next + (size_t)id * 256, 0xff, 256 * sizeof *dfa_next);
+    }
+    return id;
+}
+
+static int dfa_step(int s, unsigned char b) {
+    int t = dfa_intern(canonical(derivative(dfa_state[s], (char)b)));
+    dfa_next[(size_t)s * 256 + b] = t;
+    return t;
+}
+
+// Forget the automaton before its nodes go back to the store.  Slots are
+// cleared newest first: no older entry's probe run passes a newer slot.
+static void dfa_reset(void) {
+    while (dfa_nstates) {
+        size_t slot;
+        dfa_lookup(dfa_state[dfa_nstates - 1], &slot);
+        dfa_map[slot] = DFA_UNKNOWN;
+        dfa_nstates--;
+    }
+    dfa_dead = DFA_UNKNOWN;
+}
+
+// The strings to test, loaded once and shared read-only by all threads.
+// A blank line is the empty string.
+static char*   match_text = NULL;
+static size_t  match_text_len = 0, match_text_cap = 0;
+static size_t* match_end = NULL;        // string i is [end[i-1], end[i])
+static size_t  match_count = 0, match_cap = 0;
+
+static void match_add(const char* line, size_t len) {
+    if (match_text_len + len > match_text_cap) {
+        while (match_text_len + len > match_text_cap)
+            match_text_cap = match_text_cap ? match_text_cap * 2 : 4096;
+        match_text = xrealloc(match_text, match_text_cap);
+    }
+    if (match_count == match_cap) {
+        match_cap = match_cap ? match_cap * 2 : 256;
+        match_end = xrealloc(match_end, match_cap * sizeof *match_end);
+    }
+    memcpy(match_text + match_text_len, line, len);
+    match_text_len += len;
+    match_end[match_count++] = match_text_len;
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --engine=glushkov: bit-parallel position automaton
+//
+// Every symbol occurrence in the tree is a position, numbered 1..n left
+// to right; position 0 is the start.  The active set is a bitset, and a
+// byte c maps it to Follow(active) & Sym[c].  Follow of a set is read
+// eight positions at a time from precomputed tables, so each byte costs
+// n/8 lookups whatever the regex: linear time, with no subset
+// construction to blow up on insert-style regexes.  Regexes with more
+// than GL_MAX_POS positions are left to the DFA.
+// ─────────────────────────────────────────────────────────────────
+#define GL_MAX_POS  511
+#define GL_WORDS    ((GL_MAX_POS + 1) / 64)
+#define GL_CHUNKS   ((GL_MAX_POS + 1) / 8)
+
+typedef struct GlSet { uint64_t w[GL_WORDS]; } GlSet;
+
+typedef struct Glushkov {
+    int   npos, nwords, nchunks;        // positions 1..npos; words, bytes in use
+    GlSet sym[256];                     // positions labelled with each byte
+    GlSet follow[GL_CHUNKS * 8];
+    GlSet last;                         // accepting; bit 0 iff ε ∈ L(r)
+    GlSet step[GL_CHUNKS][256];         // Follow of each 8-position pattern
+} Glushkov;
+
+typedef struct GlFrame {                // a finished subtree
+    GlSet first, last;
+    int   nullable;
+} GlFrame;
+
+typedef struct GlTodo {
+    RegexNode* node;
+    int        combine;                 // children done: merge their frames
+} GlTodo;
+
+static _Thread_local Glushkov* gl = NULL;
+static _Thread_local GlFrame*  gl_vals = NULL;
+static _Thread_local size_t    gl_vals_cap = 0;
+static _Thread_local GlTodo*   gl_todo = NULL;
+static _Thread_local size_t    gl_todo_cap = 0;
+
+static void gl_or(GlSet* d, const GlSet* a) {
+    for (int k = 0; k < GL_WORDS; k++) d->w[k] |= a->w[k];
+}
+
+// Follow(p) |= to, for every position p in from.
+static void gl_link(const GlSet* from, const GlSet* to) {
+    for (int k = 0; k < GL_WORDS; k++)
+        for (uint64_t m = from->w[k]; m; m &= m - 1)
+            gl_or(&gl->follow[k * 64 + __builtin_ctzll(m)], to);
+}
+
+static void gl_push(size_t* top, RegexNode* n, int combine) {
+    if (*top == gl_todo_cap) {
+        gl_todo_cap = gl_todo_cap ? gl_todo_cap * 2 : 256;
+        gl_todo = xrealloc(gl_todo, gl_todo_cap * sizeof *gl_todo);
+    }
+    gl_todo[*top].node    = n;
+    gl_todo[*top].combine = combine;
+    (*top)++;
+}
+
+// Build the automaton for r into *gl; 0 if r has too many positions.
+// This walks the tree, not the DAG: a shared subtree is a fresh set of
+// positions at each occurrence.
+static int gl_build(RegexNode* r) {
+    if (!gl) gl = xmalloc(sizeof *gl);
+    memset(gl->sym, 0, sizeof gl->sym);
+    gl->npos = 0;
+
+    size_t top = 0, nvals = 0;
+    gl_push(&top, r, 0);
+    while (top) {
+        GlTodo t = gl_todo[--top];
+        RegexNode* n = t.node;
+        if (!t.combine) {
+            if (n->type == NODE_STAR) {
+                gl_push(&top, n, 1);
+                gl_push(&top, n->left, 0);
+                continue;
+            }
+            if (n->type == NODE_UNION || n->type == NODE_CONCAT) {
+                gl_push(&top, n, 1);
+                gl_push(&top, n->right, 0);
+                gl_push(&top, n->left, 0);
+                continue;
+            }
+            if (nvals == gl_vals_cap) {
+                gl_vals_cap = gl_vals_cap ? gl_vals_cap * 2 : 64;
+                gl_vals = xrealloc(gl_vals, gl_vals_cap * sizeof *gl_vals);
+            }
+            GlFrame* f = &gl_vals[nvals++];
+            memset(f, 0, sizeof *f);
+            if (n->type == NODE_CHAR) {
+                int p = ++gl->npos;
+                if (p > GL_MAX_POS) return 0;
+                memset(&gl->follow[p], 0, sizeof gl->follow[p]);
+                f->first.w[p / 64] = f->last.w[p / 64] = 1ULL << (p % 64);
+                gl->sym[(unsigned char)n->symbol].w[p / 64] |= 1ULL << (p % 64);
+            }
             continue;
         }
-        if (infinite_mode) {
-            printf(is_infinite(tree) ? "yes\n":"no\n");
-            free_tree(tree);
+        GlFrame* a = &gl_vals[nvals - 1];
+        if (n->type == NODE_STAR) {
+            gl_link(&a->last, &a->first);
+            a->nullable = 1;
             continue;
         }
-        if (startswith_mode) {
-            printf(starts_with(tree,sym) ? "yes\n":"no\n");
-            free_tree(tree);
-            continue;
+        GlFrame* b = a--;                // a = left operand, b = right
+        nvals--;
+        if (n->type == NODE_UNION) {
+            gl_or(&a->first, &b->first);
+            gl_or(&a->last, &b->last);
+            a->nullable |= b->nullable;
+        } else {
+            gl_link(&a->last, &b->first);
+            if (a->nullable) gl_or(&a->first, &b->first);
+            if (b->nullable) gl_or(&b->last, &a->last);
+            a->last = b->last;
+            a->nullable &= b->nullable;
         }
+    }
 
-        if (reverse_mode) {
-            RegexNode* rev = reverse_regex(tree);
-            print_prefix(rev);
-            printf("\n");
-            free_tree(tree);
-            free_tree(rev);
-            continue;
+    GlFrame* root = &gl_vals[0];
+    gl->nwords  = gl->npos / 64 + 1;
+    gl->nchunks = gl->npos / 8 + 1;
+    for (int p = gl->npos + 1; p < gl->nchunks * 8; p++)
+        memset(&gl->follow[p], 0, sizeof gl->follow[p]);
+    gl->follow[0] = root->first;
+    gl->last = root->last;
+    if (root->nullable) gl->last.w[0] |= 1;
+    for (int k = 0; k < gl->nchunks; k++) {
+        memset(&gl->step[k][0], 0, sizeof gl->step[k][0]);
+        for (int v = 1; v < 256; v++) {
+            gl->step[k][v] = gl->step[k][v & (v - 1)];
+            gl_or(&gl->step[k][v], &gl->follow[k * 8 + __builtin_ctz(v)]);
         }
+    }
+    return 1;
+}
 
-        if (endswith_mode) {
-            printf(ends_with(tree, sym) ? "yes\n" : "no\n");
-            free_tree(tree);
-            continue;
+static int gl_accepts(const unsigned char* p, const unsigned char* end) {
+    const int nw = gl->nwords;
+    uint64_t d[GL_WORDS] = { 1 };       // just the start position
+    for (; p < end; p++) {
+        uint64_t n[GL_WORDS] = { 0 };
+        for (int k = 0; k < nw; k++) {
+            int c = k * 8;
+            for (uint64_t x = d[k]; x; x >>= 8, c++) {
+                if (!(x & 0xff)) continue;
+                const uint64_t* f = gl->step[c][x & 0xff].w;
+                for (int j = 0; j < nw; j++) n[j] |= f[j];
+            }
         }
+        const uint64_t* s = gl->sym[*p].w;
+        uint64_t any = 0;
+        for (int j = 0; j < nw; j++) any |= d[j] = n[j] & s[j];
+        if (!any) return 0;
+    }
+    uint64_t hit = 0;
+    for (int j = 0; j < nw; j++) hit |= d[j] & gl->last.w[j];
+    return hit != 0;
+}
 
-        if (prefixes_mode) {
-            RegexNode* pref = prefixes(tree);
-            print_prefix(pref);
-            printf("\n");
-            free_tree(tree);
-            free_tree(pref);
-            continue;
+typedef enum { ENGINE_DFA, ENGINE_GLUSHKOV } MatchEngine;
+static MatchEngine match_engine = ENGINE_DFA;
+
+// One tab-separated yes/no per string in the match file.
+static void match_strings(RegexNode* tree) {
+    int glushkov = match_engine == ENGINE_GLUSHKOV && gl_build(tree);
+    int start = glushkov ? 0 : dfa_intern(canonical(tree));
+    size_t begin = 0;
+    for (size_t i = 0; i < match_count; i++) {
+        const unsigned char* p   = (const unsigned char*)match_text + begin;
+        const unsigned char* end = (const unsigned char*)match_text + match_end[i];
+        int yes;
+        if (glushkov) {
+            yes = gl_accepts(p, end);
+        } else {
+            int s = start;
+            for (; p < end && s != dfa_dead; p++) {
+                int t = dfa_next[(size_t)s * 256 + *p];
+                s = (t != DFA_UNKNOWN) ? t : dfa_step(s, *p);
+            }
+            yes = dfa_accept[s];
         }
+        if (i) out_byte(out, '\t');
+        out_str(out, yes ? "yes" : "no");
+        begin = match_end[i];
+    }
+    out_byte(out, '\n');
+    dfa_reset();
+}
 
-        if (bsfora_mode) {
-            RegexNode* replaced = bs_for_a(tree);
-            print_prefix(replaced);
-            printf("\n");
-            free_tree(tree);
-            free_tree(replaced);
-            continue;
+// ─────────────────────────────────────────────────────────────────
+// --equivalent: do two regexes denote the same language?
+//
+// Both derivative automata are built in full, into the same table, over
+// the symbols either regex uses (any other byte is dead for both).  The
+// table is minimized with Hopcroft's partition refinement; the regexes
+// are equivalent iff their start states end up in one block.  If not, a
+// breadth-first search of the pair automaton finds a shortest string
+// accepted by exactly one of them.
+// ─────────────────────────────────────────────────────────────────
+static _Thread_local int* eq_ints = NULL;      // scratch for the int arrays below
+static _Thread_local size_t eq_ints_cap = 0;
+
+static int* eq_scratch(size_t n) {
+    if (n > eq_ints_cap) {
+        while (eq_ints_cap < n) eq_ints_cap = eq_ints_cap ? eq_ints_cap * 2 : 4096;
+        eq_ints = xrealloc(eq_ints, eq_ints_cap * sizeof *eq_ints);
+    }
+    return eq_ints;
+}
+
+// Add every state reachable from the ones already interned, over syms.
+static void dfa_complete(const unsigned char* syms, int k) {
+    for (size_t s = 0; s < dfa_nstates; s++)
+        for (int j = 0; j < k; j++)
+            if (dfa_next[s * 256 + syms[j]] == DFA_UNKNOWN)
+                dfa_step((int)s, syms[j]);
+}
+
+// Hopcroft: partition the n states of the table into blocks of
+// equivalent states, writing each state's block into blk[].
+static void dfa_minimize(const unsigned char* syms, int k, int* blk) {
+    int n = (int)dfa_nstates;
+    int* a = eq_scratch((size_t)(2 * k + 9) * n + k);
+    int* pre_at = a;                    // sources of t on symbol j:
+    int* pre    = pre_at + k * (n + 1); //   pre[pre_at[j*(n+1)+t] ..]
+    int* elem   = pre + k * n;          // states grouped by block
+    int* loc    = elem + n;             // where each state sits in elem
+    int* first  = loc + n;              // block b is elem[first[b] .. end[b])
+    int* end    = first + n;
+    int* marked = end + n;              // states of b moved to its front
+    int* work   = marked + n;           // splitter stack
+    int* inwork = work + n;
+    int* touched = inwork + n;
+
+    for (int j = 0; j < k; j++) {
+        int* at = pre_at + j * (n + 1);
+        memset(at, 0, (n + 1) * sizeof *at);
+        for (int s = 0; s < n; s++) at[dfa_next[(size_t)s * 256 + syms[j]] + 1]++;
+        for (int t = 0; t < n; t++) at[t + 1] += at[t];
+        for (int s = 0; s < n; s++) pre[j * n + at[dfa_next[(size_t)s * 256 + syms[j]]]++] = s;
+        for (int t = n; t > 0; t--) at[t] = at[t - 1];
+        at[0] = 0;
+    }
+
+    // Initial partition: accepting states, then the rest.
+    int nblocks = 0, pos = 0;
+    for (int acc = 1; acc >= 0; acc--) {
+        int start = pos;
+        for (int s = 0; s < n; s++)
+            if (dfa_accept[s] == acc) { loc[s] = pos; elem[pos++] = s; blk[s] = nblocks; }
+        if (pos > start) {
+            first[nblocks] = start; end[nblocks] = pos;
+            marked[nblocks] = inwork[nblocks] = 0;
+            nblocks++;
         }
+    }
+    int nwork = 0;
+    if (nblocks == 2) {
+        int small = (end[0] - first[0] <= end[1] - first[1]) ? 0 : 1;
+        work[nwork++] = small; inwork[small] = 1;
+    }
 
-        if (strip_mode) {
-            RegexNode* stripped = strip_symbol(tree, sym);
-            print_prefix(stripped);
-            printf("\n");
-            free_tree(tree);
-            free_tree(stripped);
-            continue;
+    int* snap = touched + n;            // the splitter's states, copied
+    while (nwork) {
+        int b = work[--nwork];
+        inwork[b] = 0;
+        int nsnap = end[b] - first[b];
+        memcpy(snap, elem + first[b], nsnap * sizeof *snap);
+        for (int j = 0; j < k; j++) {
+            int ntouched = 0;
+            const int* at = pre_at + j * (n + 1);
+            for (int i = 0; i < nsnap; i++)
+                for (int p = at[snap[i]]; p < at[snap[i] + 1]; p++) {
+                    int x = pre[j * n + p], y = blk[x];
+                    int to = first[y] + marked[y];
+                    if (loc[x] < to) continue;              // already marked
+                    if (marked[y]++ == 0) touched[ntouched++] = y;
+                    int other = elem[to];
+                    elem[to] = x;      elem[loc[x]] = other;
+                    loc[other] = loc[x]; loc[x] = to;
+                }
+            for (int i = 0; i < ntouched; i++) {
+                int y = touched[i], m = marked[y];
+                marked[y] = 0;
+                if (m == end[y] - first[y]) continue;
+                int z = nblocks++;                          // z takes the marked part
+                first[z] = first[y]; end[z] = first[y] + m;
+                first[y] += m;
+                marked[z] = inwork[z] = 0;
+                for (int p = first[z]; p < end[z]; p++) blk[elem[p]] = z;
+                int add = inwork[y] ? z : (m <= end[y] - first[y] ? z : y);
+                work[nwork++] = add; inwork[add] = 1;
+            }
         }
+    }
+}
 
-        if (insert_mode) {
-            RegexNode* ins = insert_symbol(tree, sym);
-            print_prefix(ins);
-            printf("\n");
-            free_tree(tree);
-            free_tree(ins);
-            continue;
+// The slot of pair key k in map: where it is, or the empty slot for it.
+static size_t pair_slot(const int* map, size_t mcap, const uint64_t* key, uint64_t k) {
+    size_t i = (k * 0x9E3779B97F4A7C15ULL) >> 20 & (mcap - 1);
+    while (map[i] != -1 && key[map[i]] != k) i = (i + 1) & (mcap - 1);
+    return i;
+}
+
+// Shortest string accepted by exactly one of s and t (which must not be
+// equivalent), written to out.  Pairs of states are searched in BFS order.
+static void dfa_distinguish(int s, int t, const unsigned char* syms, int k) {
+    size_t n = dfa_nstates, cap = 1024, npairs = 0;
+    while (cap < 4 * n) cap *= 2;
+    // Each pair: its key, the pair it came from and the symbol taken.
+    uint64_t* key  = xmalloc(cap * sizeof *key);
+    int*      from = xmalloc(cap * sizeof *from);
+    unsigned char* via = xmalloc(cap);
+    size_t mcap = 2 * cap;
+    int* map = xmalloc(mcap * sizeof *map);
+    memset(map, 0xff, mcap * sizeof *map);
+
+    key[0] = (uint64_t)s * n + t; from[0] = -1; npairs = 1;
+    map[pair_slot(map, mcap, key, key[0])] = 0;
+    size_t hit = 0;
+    for (size_t q = 0; q < npairs; q++) {
+        int a = (int)(key[q] / n), b = (int)(key[q] % n);
+        if (dfa_accept[a] != dfa_accept[b]) { hit = q; break; }
+        for (int j = 0; j < k; j++) {
+            uint64_t nk = (uint64_t)dfa_next[(size_t)a * 256 + syms[j]] * n
+                        + dfa_next[(size_t)b * 256 + syms[j]];
+            size_t i = pair_slot(map, mcap, key, nk);
+            if (map[i] != -1) continue;
+            if (npairs == cap) {
+                cap *= 2;
+                key  = xrealloc(key,  cap * sizeof *key);
+                from = xrealloc(from, cap * sizeof *from);
+                via  = xrealloc(via,  cap);
+            }
+            key[npairs] = nk; from[npairs] = (int)q; via[npairs] = syms[j];
+            map[i] = (int)npairs++;
+            if (2 * npairs > mcap) {
+                mcap *= 2;
+                map = xrealloc(map, mcap * sizeof *map);
+                memset(map, 0xff, mcap * sizeof *map);
+                for (size_t p = 0; p < npairs; p++)
+                    map[pair_slot(map, mcap, key, key[p])] = (int)p;
+            }
         }
-     
-        // Default: --no-op
-        print_prefix(tree);
-        printf("\n");
-        free_tree(tree);
     }
+    size_t len = 0;
+    for (int q = (int)hit; from[q] != -1; q = from[q]) len++;
+    if (out->cap - out->len < len) out_make_room(out, len);
+    size_t at = out->len + len;
+    for (int q = (int)hit; from[q] != -1; q = from[q]) out->data[--at] = (char)via[q];
+    out->len += len;
+    free(key); free(from); free(via); free(map);
+}
+
+// Print "yes", or "no" and a tab and a shortest counterexample (empty
+// for ε).
+static void print_equivalent(RegexNode* r1, RegexNode* r2) {
+    unsigned char syms[64];
+    int k = 0;
+    for (SymSet m = r1->uses | r2->uses; m; m &= m - 1)
+        syms[k++] = (unsigned char)index_sym(__builtin_ctzll(m));
+    int s = dfa_intern(canonical(r1));
+    int t = dfa_intern(canonical(r2));
+    dfa_complete(syms, k);
+    int equal = s == t;
+    if (!equal) {
+        int* blk = xmalloc(dfa_nstates * sizeof *blk);
+        dfa_minimize(syms, k, blk);
+        equal = blk[s] == blk[t];
+        free(blk);
+    }
+    if (equal) {
+        out_str(out, "yes\n");
+    } else {
+        out_str(out, "no\t");
+        dfa_distinguish(s, t, syms, k);
+        out_byte(out, '\n');
+    }
+    dfa_reset();
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --compile FILE / --load FILE: precompiled automata
+//
+// --compile minimizes each input regex's DFA (as --equivalent does) and
+// writes them all to one flat file.  --load maps that file read-only
+// and answers, for every string on stdin, one yes/no per automaton: no
+// parsing, no derivatives, no allocation per string.  All offsets are
+// from the start of the file, so the mapping can sit at any address and
+// processes share its pages.  Integers are in host byte order.
+//
+//   DfaFileHeader                      magic, version, count, file size
+//   DfaFileEntry[count]                one per regex
+//   per entry, each 8-byte aligned:
+//     uint8_t  class[256]              byte → symbol class; 0 = no symbol
+//     uint32_t next[nstates][nclasses] transition table
+//     uint64_t accept[(nstates+63)/64] accepting states, as bits
+// ─────────────────────────────────────────────────────────────────
+#define DFA_FILE_MAGIC   "RXTDFA\0\0"
+#define DFA_FILE_VERSION 1
+
+typedef struct DfaFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t size;
+} DfaFileHeader;
+
+typedef struct DfaFileEntry {
+    uint32_t nstates, nclasses;
+    uint32_t start, dead;
+    uint64_t class_off, next_off, accept_off;
+} DfaFileEntry;
+
+static DfaFileEntry*  compile_entries = NULL;   // offsets relative to compile_data
+static size_t         compile_count = 0, compile_cap = 0;
+static unsigned char* compile_data = NULL;
+static size_t         compile_len = 0, compile_data_cap = 0;
+
+static size_t compile_reserve(size_t n) {
+    size_t at = (compile_len + 7) & ~(size_t)7;
+    if (at + n > compile_data_cap) {
+        while (at + n > compile_data_cap)
+            compile_data_cap = compile_data_cap ? compile_data_cap * 2 : 65536;
+        compile_data = xrealloc(compile_data, compile_data_cap);
+    }
+    memset(compile_data + compile_len, 0, at + n - compile_len);
+    compile_len = at + n;
+    return at;
+}
+
+static void compile_regex(RegexNode* tree) {
+    unsigned char syms[64];
+    int k = 0;
+    for (SymSet m = tree->uses; m; m &= m - 1)
+        syms[k++] = (unsigned char)index_sym(__builtin_ctzll(m));
+    int start = dfa_intern(canonical(tree));
+    int dead  = dfa_intern(make_node(NODE_EMPTY, 0, NULL, NULL));
+    dfa_complete(syms, k);
+
+    int n = (int)dfa_nstates, nblocks = 0;
+    int* blk = xmalloc((size_t)n * 2 * sizeof *blk);
+    int* rep = blk + n;                 // one state of each block
+    dfa_minimize(syms, k, blk);
+    for (int st = 0; st < n; st++) {
+        if (blk[st] >= nblocks) nblocks = blk[st] + 1;
+        rep[blk[st]] = st;
+    }
+
+    if (compile_count == compile_cap) {
+        compile_cap = compile_cap ? compile_cap * 2 : 16;
+        compile_entries = xrealloc(compile_entries, compile_cap * sizeof *compile_entries);
+    }
+    DfaFileEntry* e = &compile_entries[compile_count++];
+    e->nstates  = (uint32_t)nblocks;
+    e->nclasses = (uint32_t)k + 1;
+    e->start    = (uint32_t)blk[start];
+    e->dead     = (uint32_t)blk[dead];
+    e->class_off  = compile_reserve(256);
+    e->next_off   = compile_reserve((size_t)nblocks * e->nclasses * sizeof(uint32_t));
+    e->accept_off = compile_reserve((size_t)(nblocks + 63) / 64 * sizeof(uint64_t));
+
+    unsigned char* cls = compile_data + e->class_off;
+    for (int j = 0; j < k; j++) cls[syms[j]] = (unsigned char)(j + 1);
+    uint32_t* next = (uint32_t*)(compile_data + e->next_off);
+    uint64_t* acc  = (uint64_t*)(compile_data + e->accept_off);
+    for (int b = 0; b < nblocks; b++) {
+        uint32_t* row = next + (size_t)b * e->nclasses;
+        row[0] = e->dead;
+        for (int j = 0; j < k; j++)
+            row[j + 1] = (uint32_t)blk[dfa_next[(size_t)rep[b] * 256 + syms[j]]];
+        if (dfa_accept[rep[b]]) acc[b / 64] |= 1ULL << (b % 64);
+    }
+    free(blk);
+    dfa_reset();
+}
+
+static void compile_write(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    size_t base = sizeof(DfaFileHeader) + compile_count * sizeof(DfaFileEntry);
+    base = (base + 7) & ~(size_t)7;
+    for (size_t i = 0; i < compile_count; i++) {
+        compile_entries[i].class_off  += base;
+        compile_entries[i].next_off   += base;
+        compile_entries[i].accept_off += base;
+    }
+    DfaFileHeader h;
+    memcpy(h.magic, DFA_FILE_MAGIC, sizeof h.magic);
+    h.version = DFA_FILE_VERSION;
+    h.count   = (uint32_t)compile_count;
+    h.size    = base + compile_len;
+    static const char pad[8];
+    struct iovec iov[4] = {
+        { &h, sizeof h },
+        { compile_entries, compile_count * sizeof *compile_entries },
+        { (void*)pad, base - sizeof h - compile_count * sizeof *compile_entries },
+        { compile_data, compile_len },
+    };
+    write_all_iov(fd, iov, 4);
+    if (close(fd) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+static const unsigned char* load_map = NULL;
+static const DfaFileEntry*  load_entries = NULL;
+static uint32_t             load_count = 0;
+
+// Map and check a compiled file, so that matching can trust every
+// offset and every table entry.  Returns 0 with a message on error.
+static int load_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    const DfaFileHeader* h = NULL;
+    if (size >= sizeof *h) {
+        void* m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED) load_map = m;
+    }
+    close(fd);
+    h = (const DfaFileHeader*)load_map;
+    if (!h || memcmp(h->magic, DFA_FILE_MAGIC, sizeof h->magic) != 0 || h->size != size) {
+        fprintf(stderr, "Error: %s is not a compiled automaton file\n", path);
+        return 0;
+    }
+    if (h->version != DFA_FILE_VERSION) {
+        fprintf(stderr, "Error: %s has format version %u, expected %u\n",
+                path, (unsigned)h->version, (unsigned)DFA_FILE_VERSION);
+        return 0;
+    }
+    if (h->count > (size - sizeof *h) / sizeof(DfaFileEntry))
+        goto corrupt;
+    load_entries = (const DfaFileEntry*)(load_map + sizeof *h);
+    load_count   = h->count;
+    for (uint32_t i = 0; i < load_count; i++) {
+        const DfaFileEntry* e = &load_entries[i];
+        uint64_t ns = e->nstates, nc = e->nclasses;
+        if (ns == 0 || nc == 0 || nc > 256 || e->start >= ns || e->dead >= ns
+            || (e->class_off | e->next_off | e->accept_off) % 8
+            || e->class_off > size || size - e->class_off < 256
+            || e->next_off > size || (size - e->next_off) / 4 / nc < ns
+            || e->accept_off > size || (size - e->accept_off) / 8 < (ns + 63) / 64)
+            goto corrupt;
+        const unsigned char* cls = load_map + e->class_off;
+        for (int b = 0; b < 256; b++)
+            if (cls[b] >= nc) goto corrupt;
+        const uint32_t* next = (const uint32_t*)(load_map + e->next_off);
+        for (uint64_t t = 0; t < ns * nc; t++)
+            if (next[t] >= ns) goto corrupt;
+    }
+    return 1;
+corrupt:
+    fprintf(stderr, "Error: %s is corrupt\n", path);
+    return 0;
+}
+
+// One tab-separated yes/no per compiled regex for this string.
+static void load_line(const char* line, size_t len) {
+    for (uint32_t i = 0; i < load_count; i++) {
+        const DfaFileEntry* e = &load_entries[i];
+        const unsigned char* cls  = load_map + e->class_off;
+        const uint32_t*      next = (const uint32_t*)(load_map + e->next_off);
+        const uint64_t*      acc  = (const uint64_t*)(load_map + e->accept_off);
+        const uint32_t nc = e->nclasses, dead = e->dead;
+        uint32_t s = e->start;
+        for (size_t p = 0; p < len && s != dead; p++)
+            s = next[(size_t)s * nc + cls[(unsigned char)line[p]]];
+        if (i) out_byte(out, '\t');
+        out_str(out, (acc[s / 64] >> (s % 64) & 1) ? "yes" : "no");
+    }
+    out_byte(out, '\n');
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --count N / --cardinality: exact language sizes
+//
+// Both work on the minimal DFA (as built for --compile) with the dead
+// block dropped, so every state left can still reach acceptance.  The
+// number of strings of length N is then a path count: start from the
+// start state, step N times along the transitions (an edge reached by
+// two symbols counts twice) and add up the accepting states.
+//
+// Counts grow like k^N, so they are arbitrary-precision integers.  For
+// small N the path count is a plain dynamic program over the edges; for
+// large N it is the start row of M^N by repeated squaring, where M is
+// the transfer matrix.  Squaring costs a cube in the states but only
+// log N steps, and Karatsuba keeps the big products cheap; the cheaper
+// of the two, by a rough operation count, is used.
+//
+// A finite language has no cycle among the live states, so its
+// strings are no longer than the number of states and --cardinality
+// is the same dynamic program summed over those lengths.
+// ─────────────────────────────────────────────────────────────────
+typedef struct BigNum {
+    uint32_t* d;                // limbs, least significant first
+    size_t    n, cap;           // n == 0 is zero; d[n-1] != 0 otherwise
+} BigNum;
+
+static void big_reserve(BigNum* a, size_t n) {
+    if (n > a->cap) {
+        a->cap = n > 2 * a->cap ? n : 2 * a->cap;
+        a->d = xrealloc(a->d, a->cap * sizeof *a->d);
+    }
+}
+
+static void big_trim(BigNum* a) {
+    while (a->n && a->d[a->n - 1] == 0) a->n--;
+}
+
+static void big_set(BigNum* a, uint32_t v) {
+    big_reserve(a, 1);
+    a->d[0] = v;
+    a->n = v != 0;
+}
+
+// a += b * m
+static void big_addmul(BigNum* a, const BigNum* b, uint32_t m) {
+    size_t n = (a->n > b->n ? a->n : b->n) + 2;
+    big_reserve(a, n);
+    memset(a->d + a->n, 0, (n - a->n) * sizeof *a->d);
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < b->n; i++) {
+        carry += a->d[i] + (uint64_t)b->d[i] * m;
+        a->d[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry; i++) {
+        carry += a->d[i];
+        a->d[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    a->n = n;
+    big_trim(a);
+}
+
+// r[0 .. an+bn) = a * b, schoolbook; r must not overlap a or b.
+static void limbs_mul_basic(uint32_t* r, const uint32_t* a, size_t an,
+                            const uint32_t* b, size_t bn) {
+    memset(r, 0, (an + bn) * sizeof *r);
+    for (size_t i = 0; i < an; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < bn; j++) {
+            carry += r[i + j] + (uint64_t)a[i] * b[j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r[i + bn] = (uint32_t)carry;
+    }
+}
+
+// r[0 .. n) += a[0 .. an), returning the carry out of r[n-1].
+static uint32_t limbs_add(uint32_t* r, size_t n, const uint32_t* a, size_t an) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        carry += (uint64_t)r[i] + a[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry && i < n; i++) {
+        carry += r[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return (uint32_t)carry;
+}
+
+// r[0 .. n) -= a[0 .. an); the result must not go negative.
+static void limbs_sub(uint32_t* r, size_t n, const uint32_t* a, size_t an) {
+    int64_t borrow = 0;
+    size_t i = 0;
+    for (; i < an; i++) {
+        int64_t t = (int64_t)r[i] - a[i] - borrow;
+        borrow = t < 0;
+        r[i] = (uint32_t)t;
+    }
+    for (; borrow && i < n; i++) {
+        borrow = r[i] == 0;
+        r[i]--;
+    }
+}
+
+#define KARATSUBA_MIN 48
+
+// r[0 .. 2n) = a * b for n-limb a and b.  t is scratch of 8n + 64 limbs;
+// the recursion halves n, so its depth is only log n.
+static void limbs_mul_kara(uint32_t* r, const uint32_t* a, const uint32_t* b,
+                           size_t n, uint32_t* t) {
+    if (n < KARATSUBA_MIN) {
+        limbs_mul_basic(r, a, n, b, n);
+        return;
+    }
+    size_t h = n / 2, m = n - h;        // low halves h limbs, high halves m
+    uint32_t* sa = t;                   // a0 + a1, m + 1 limbs
+    uint32_t* sb = sa + m + 1;          // b0 + b1
+    uint32_t* z1 = sb + m + 1;          // sa * sb, 2m + 2 limbs
+    uint32_t* rest = z1 + 2 * m + 2;
+
+    limbs_mul_kara(r, a, b, h, rest);                   // z0 = a0 b0
+    limbs_mul_kara(r + 2 * h, a + h, b + h, m, rest);   // z2 = a1 b1 (m >= h)
+    memcpy(sa, a + h, m * sizeof *sa);
+    sa[m] = limbs_add(sa, m, a, h);
+    memcpy(sb, b + h, m * sizeof *sb);
+    sb[m] = limbs_add(sb, m, b, h);
+    limbs_mul_kara(z1, sa, sb, m + 1, rest);
+    limbs_sub(z1, 2 * m + 2, r, 2 * h);                 // z1 = a0 b1 + a1 b0
+    limbs_sub(z1, 2 * m + 2, r + 2 * h, 2 * m);
+    size_t zn = 2 * m + 2 < 2 * n - h ? 2 * m + 2 : 2 * n - h;
+    limbs_add(r + h, 2 * n - h, z1, zn);
+}
+
+static _Thread_local uint32_t* mul_scratch = NULL;
+static _Thread_local size_t    mul_scratch_cap = 0;
+
+// r = a * b; r must be distinct from a and b.
+static void big_mul(BigNum* r, const BigNum* a, const BigNum* b) {
+    if (!a->n || !b->n) { r->n = 0; return; }
+    if (a->n < b->n) { const BigNum* t = a; a = b; b = t; }
+    big_reserve(r, a->n + b->n);
+    if (b->n < KARATSUBA_MIN || b->n * 2 < a->n) {
+        limbs_mul_basic(r->d, a->d, a->n, b->d, b->n);
+    } else {
+        // Pad b to a's length; both halves of the split then line up.
+        size_t n = a->n, need = n + 10 * n + 64;
+        if (need > mul_scratch_cap) {
+            mul_scratch_cap = need;
+            mul_scratch = xrealloc(mul_scratch, need * sizeof *mul_scratch);
+        }
+        memcpy(mul_scratch, b->d, b->n * sizeof *mul_scratch);
+        memset(mul_scratch + b->n, 0, (n - b->n) * sizeof *mul_scratch);
+        big_reserve(r, 2 * n);
+        limbs_mul_kara(r->d, a->d, mul_scratch, n, mul_scratch + n);
+    }
+    r->n = a->n + b->n;
+    big_trim(r);
+}
+
+// Decimal, nine digits at a time off a scratch copy.
+static void big_print(const BigNum* a) {
+    if (!a->n) { out_byte(out, '0'); return; }
+    uint32_t* q = xmalloc(a->n * sizeof *q);
+    uint32_t* chunk = xmalloc((a->n * 32 / 29 + 2) * sizeof *chunk);
+    memcpy(q, a->d, a->n * sizeof *q);
+    size_t n = a->n, nchunks = 0;
+    while (n) {
+        uint64_t rem = 0;
+        for (size_t i = n; i-- > 0; ) {
+            uint64_t cur = rem << 32 | q[i];
+            q[i] = (uint32_t)(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+        chunk[nchunks++] = (uint32_t)rem;
+        while (n && q[n - 1] == 0) n--;
+    }
+    char buf[16];
+    snprintf(buf, sizeof buf, "%u", chunk[nchunks - 1]);
+    out_str(out, buf);
+    for (size_t i = nchunks - 1; i-- > 0; ) {
+        snprintf(buf, sizeof buf, "%09u", chunk[i]);
+        out_str(out, buf);
+    }
+    free(q);
+    free(chunk);
+}
+
+static void big_free(BigNum* a, size_t n) {
+    for (size_t i = 0; i < n; i++) free(a[i].d);
+    free(a);
+}
+
+// The trimmed minimal DFA of one regex: live states 0..n-1, start 0
+// (n == 0 for the empty language).  Each state has its out-edges as
+// (target, multiplicity) pairs, for counting, and its target on each
+// symbol (-1 if dead), for --enumerate; symbols are in byte order.
+typedef struct LiveDfa {
+    int  n, k;
+    unsigned char syms[64];
+    int* next;                  // [s * k + j]
+    int* edge_at;               // state s: edges [edge_at[s], edge_at[s+1])
+    int* edge_to;
+    uint32_t* edge_mult;
+    unsigned char* accept;
+} LiveDfa;
+
+static void live_dfa_build(RegexNode* tree, LiveDfa* c) {
+    unsigned char* syms = c->syms;
+    int k = 0;
+    for (SymSet m = tree->uses; m; m &= m - 1) {
+        unsigned char b = (unsigned char)index_sym(__builtin_ctzll(m));
+        int j = k++;
+        for (; j > 0 && syms[j - 1] > b; j--) syms[j] = syms[j - 1];
+        syms[j] = b;
+    }
+    c->k = k;
+    int start = dfa_intern(canonical(tree));
+    int dead  = dfa_intern(make_node(NODE_EMPTY, 0, NULL, NULL));
+    dfa_complete(syms, k);
+
+    int n = (int)dfa_nstates;
+    int* blk = xmalloc((size_t)n * 3 * sizeof *blk);
+    int* idx = blk + n;                 // block → live state number, or -1
+    int* rep = idx + n;                 // live state number → a member
+    dfa_minimize(syms, k, blk);
+    for (int b = 0; b < n; b++) idx[b] = -1;
+    c->n = 0;
+    if (blk[start] != blk[dead]) {      // number the live blocks, start first
+        idx[blk[start]] = c->n;
+        rep[c->n++] = start;
+        for (int s = 0; s < n; s++)
+            if (blk[s] != blk[dead] && idx[blk[s]] < 0) {
+                idx[blk[s]] = c->n;
+                rep[c->n++] = s;
+            }
+    }
+    c->next      = xmalloc(((size_t)c->n * k + 1) * sizeof *c->next);
+    c->edge_at   = xmalloc(((size_t)c->n + 1) * sizeof *c->edge_at);
+    c->edge_to   = xmalloc(((size_t)c->n * k + 1) * sizeof *c->edge_to);
+    c->edge_mult = xmalloc(((size_t)c->n * k + 1) * sizeof *c->edge_mult);
+    c->accept    = xmalloc((size_t)c->n + 1);
+    int ne = 0;
+    for (int i = 0; i < c->n; i++) {
+        c->edge_at[i] = ne;
+        c->accept[i] = dfa_accept[rep[i]];
+        for (int j = 0; j < k; j++) {
+            int t = idx[blk[dfa_next[(size_t)rep[i] * 256 + syms[j]]]];
+            c->next[(size_t)i * k + j] = t;
+            if (t < 0) continue;
+            int e = c->edge_at[i];
+            while (e < ne && c->edge_to[e] != t) e++;
+            if (e == ne) { c->edge_to[ne] = t; c->edge_mult[ne++] = 0; }
+            c->edge_mult[e]++;
+        }
+    }
+    c->edge_at[c->n] = ne;
+    free(blk);
+    dfa_reset();
+}
+
+static void live_dfa_free(LiveDfa* c) {
+    free(c->next);
+    free(c->edge_at);
+    free(c->edge_to);
+    free(c->edge_mult);
+    free(c->accept);
+}
+
+// Paths of exactly `steps` edges from the start, by dynamic program.
+// If `sum_all`, the total over every length 0..steps instead.
+static void count_dp(const LiveDfa* c, unsigned long long steps, int sum_all, BigNum* total) {
+    BigNum* v = xcalloc((size_t)c->n * 2, sizeof *v);
+    BigNum* w = v + c->n;
+    big_set(&v[0], 1);
+    total->n = 0;
+    for (unsigned long long step = 0; ; step++) {
+        if (sum_all || step == steps)
+            for (int i = 0; i < c->n; i++)
+                if (c->accept[i]) big_addmul(total, &v[i], 1);
+        if (step == steps) break;
+        for (int i = 0; i < c->n; i++) w[i].n = 0;
+        for (int i = 0; i < c->n; i++)
+            for (int e = c->edge_at[i]; v[i].n && e < c->edge_at[i + 1]; e++)
+                big_addmul(&w[c->edge_to[e]], &v[i], c->edge_mult[e]);
+        for (int i = 0; i < c->n; i++) {
+            BigNum t = v[i]; v[i] = w[i]; w[i] = t;
+        }
+    }
+    big_free(v, (size_t)c->n * 2);
+}
+
+// Row 0 of M^steps by repeated squaring, summed over accepting states.
+static void count_matrix(const LiveDfa* c, unsigned long long steps, BigNum* total) {
+    size_t n = (size_t)c->n;
+    BigNum* p   = xcalloc(n * n, sizeof *p);    // M^(2^i)
+    BigNum* q   = xcalloc(n * n, sizeof *q);    // its square, being built
+    BigNum* v   = xcalloc(n, sizeof *v);        // start row times the powers so far
+    BigNum* w   = xcalloc(n, sizeof *w);
+    BigNum prod = { NULL, 0, 0 };
+    for (size_t i = 0; i < n; i++)
+        for (int e = c->edge_at[i]; e < c->edge_at[i + 1]; e++)
+            big_set(&p[i * n + c->edge_to[e]], c->edge_mult[e]);
+    big_set(&v[0], 1);
+    for (;;) {
+        if (steps & 1) {
+            for (size_t j = 0; j < n; j++) w[j].n = 0;
+            for (size_t i = 0; i < n; i++)
+                for (size_t j = 0; v[i].n && j < n; j++) {
+                    big_mul(&prod, &v[i], &p[i * n + j]);
+                    big_addmul(&w[j], &prod, 1);
+                }
+            BigNum* t = v; v = w; w = t;
+        }
+        steps >>= 1;
+        if (!steps) break;
+        for (size_t i = 0; i < n * n; i++) q[i].n = 0;
+        for (size_t i = 0; i < n; i++)
+            for (size_t m = 0; m < n; m++)
+                for (size_t j = 0; p[i * n + m].n && j < n; j++) {
+                    big_mul(&prod, &p[i * n + m], &p[m * n + j]);
+                    big_addmul(&q[i * n + j], &prod, 1);
+                }
+        BigNum* t = p; p = q; q = t;
+    }
+    total->n = 0;
+    for (size_t i = 0; i < n; i++)
+        if (c->accept[i]) big_addmul(total, &v[i], 1);
+    free(prod.d);
+    big_free(p, n * n);
+    big_free(q, n * n);
+    big_free(v, n);
+    big_free(w, n);
+}
+
+// --count N: the number of strings of length N in L(r).
+static void print_count(RegexNode* tree, unsigned long long len) {
+    LiveDfa c;
+    BigNum total = { NULL, 0, 0 };
+    live_dfa_build(tree, &c);
+    if (c.n > 0) {
+        // Rough limb operations: the DP adds every edge's count each
+        // step; squaring multiplies n^3 pairs, dominated by the last.
+        unsigned long out_deg = 1;
+        for (int i = 0; i < c.n; i++) {
+            unsigned long d = 0;
+            for (int e = c.edge_at[i]; e < c.edge_at[i + 1]; e++) d += c.edge_mult[e];
+            if (d > out_deg) out_deg = d;
+        }
+        double limbs = (double)len * (64 - __builtin_clzl(out_deg)) / 32 + 1;
+        double kara = 1, m = limbs;             // Karatsuba: 3 half-size products
+        for (; m >= KARATSUBA_MIN; m /= 2) kara *= 3;
+        kara *= m * m;
+        double dp  = (double)len * (c.edge_at[c.n] + c.n) * limbs / 2;
+        double mat = 4.0 * c.n * c.n * c.n * kara;
+        if (mat < dp) count_matrix(&c, len, &total);
+        else          count_dp(&c, len, 0, &total);
+    }
+    big_print(&total);
+    out_byte(out, '\n');
+    free(total.d);
+    live_dfa_free(&c);
+}
+
+// --cardinality: |L(r)|, or "infinite".
+static void print_cardinality(RegexNode* tree) {
+    if (is_infinite(tree)) {
+        out_str(out, "infinite\n");
+        return;
+    }
+    LiveDfa c;
+    BigNum total = { NULL, 0, 0 };
+    live_dfa_build(tree, &c);
+    if (c.n > 0) count_dp(&c, (unsigned long long)c.n - 1, 1, &total);
+    big_print(&total);
+    out_byte(out, '\n');
+    free(total.d);
+    live_dfa_free(&c);
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --enumerate K / --enumerate-upto N: strings of L(r) in shortlex order
+//
+// Lengths are taken in turn, and within one length a depth-first walk
+// of the live DFA tries symbols in byte order, so strings come out
+// sorted.  States whose language is empty are already gone from the
+// live DFA, and a branch is only entered if it can end in an accepting
+// state in exactly the steps left: fill[r] is the set of states that
+// can, built from fill[r-1] one length at a time.  Each set depends
+// only on the one before, so once a set repeats an earlier one the
+// sequence cycles and no more are built; how many are kept depends on
+// the automaton, not on K or N.  Beyond that the walk holds a single
+// string and its path, however many strings are printed.
+//
+// Each string is printed as "rank\tstring", ranks from 0, and an empty
+// line ends the list for one regex.
+// ─────────────────────────────────────────────────────────────────
+// Where fill[r] is kept: sets from `loop` on repeat every `period`.
+static size_t fill_at(size_t r, size_t loop, size_t period) {
+    return (!period || r < loop + period) ? r : loop + (r - loop) % period;
+}
+
+static uint64_t fill_hash(const uint64_t* f, size_t words) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < words; i++) h = (h ^ f[i]) * 0x100000001B3ULL;
+    return h | 1;
+}
+
+static void print_enumeration(RegexNode* tree, unsigned long long limit, int upto) {
+    LiveDfa c;
+    live_dfa_build(tree, &c);
+    size_t words = ((size_t)c.n + 63) / 64;
+    unsigned long long max_len = upto ? limit : ULLONG_MAX;
+    if (c.n && !is_infinite(tree) && max_len > (unsigned long long)c.n - 1)
+        max_len = (unsigned long long)c.n - 1;     // no longer strings exist
+
+    uint64_t* fill = NULL;              // fill[r * words ..], r < loop + period
+    uint64_t* hash = NULL;              // fill_hash of each kept set
+    size_t*   seen = NULL;              // open addressing: set number + 1
+    size_t    fill_cap = 0, seen_cap = 0, loop = 0, period = 0;
+    int*      path = NULL;              // state after d symbols
+    int*      choice = NULL;            // next symbol to try at depth d
+    char*     str = NULL;
+    size_t    cap = 0;
+    unsigned long long rank = 0;
+    char buf[32];
+    for (size_t len = 0; c.n && len <= max_len && (upto || rank < limit); len++) {
+        if (len + 1 > cap) {
+            cap = cap ? cap * 2 : 64;
+            path   = xrealloc(path,   cap * sizeof *path);
+            choice = xrealloc(choice, cap * sizeof *choice);
+            str    = xrealloc(str,    cap);
+        }
+        if (!period) {
+            if (len + 1 > fill_cap) {
+                fill_cap = fill_cap ? fill_cap * 2 : 64;
+                fill = xrealloc(fill, fill_cap * words * sizeof *fill);
+                hash = xrealloc(hash, fill_cap * sizeof *hash);
+            }
+            if (2 * (len + 1) > seen_cap) {
+                seen_cap = seen_cap ? seen_cap * 2 : 128;
+                free(seen);
+                seen = xcalloc(seen_cap, sizeof *seen);
+                for (size_t r = 0; r < len; r++) {
+                    size_t i = hash[r] & (seen_cap - 1);
+                    while (seen[i]) i = (i + 1) & (seen_cap - 1);
+                    seen[i] = r + 1;
+                }
+            }
+            uint64_t* f = fill + len * words;
+            memset(f, 0, words * sizeof *f);
+            for (int s = 0; s < c.n; s++) {
+                int in = len == 0 && c.accept[s];
+                if (len) {
+                    const uint64_t* prev = f - words;
+                    for (int j = 0; !in && j < c.k; j++) {
+                        int t = c.next[(size_t)s * c.k + j];
+                        in = t >= 0 && (prev[t / 64] >> (t % 64) & 1);
+                    }
+                }
+                if (in) f[s / 64] |= (uint64_t)1 << (s % 64);
+            }
+            hash[len] = fill_hash(f, words);
+            size_t i = hash[len] & (seen_cap - 1);
+            for (; seen[i]; i = (i + 1) & (seen_cap - 1)) {
+                size_t r = seen[i] - 1;
+                if (hash[r] == hash[len] && memcmp(fill + r * words, f, words * sizeof *f) == 0) {
+                    loop   = r;
+                    period = len - r;
+                    break;
+                }
+            }
+            if (!period) seen[i] = len + 1;
+        }
+        if (!(fill[fill_at(len, loop, period) * words] & 1))
+            continue;                   // nothing of this length from the start
+
+        long d = 0;
+        path[0] = 0;
+        choice[0] = 0;
+        while (d >= 0) {
+            if ((size_t)d == len) {
+                snprintf(buf, sizeof buf, "%llu\t", rank);
+                out_str(out, buf);
+                for (size_t i = 0; i < len; i++) out_byte(out, str[i]);
+                out_byte(out, '\n');
+                if (++rank == limit && !upto) break;
+                d--;
+                continue;
+            }
+            const uint64_t* rest = fill + fill_at(len - (size_t)d - 1, loop, period) * words;
+            int s = path[d], j = choice[d], t = -1;
+            for (; j < c.k; j++) {
+                t = c.next[(size_t)s * c.k + j];
+                if (t >= 0 && (rest[t / 64] >> (t % 64) & 1)) break;
+            }
+            if (j == c.k) { d--; continue; }
+            choice[d] = j + 1;
+            str[d] = (char)c.syms[j];
+            path[d + 1] = t;
+            choice[d + 1] = 0;
+            d++;
+        }
+    }
+    out_byte(out, '\n');
+    free(fill);
+    free(hash);
+    free(seen);
+    free(path);
+    free(choice);
+    free(str);
+    live_dfa_free(&c);
+}
+
+// Lines are taken in pairs; the first of each pair waits here as text,
+// since its nodes do not survive store_reset().  One left waiting at the
+// end of the input is an error.
+static _Thread_local char*  eq_pending = NULL;
+static _Thread_local size_t eq_pending_len = 0, eq_pending_cap = 0;
+static _Thread_local int    eq_have_pending = 0;
+
+// ─────────────────────────────────────────────────────────────────
+// Driver
+// ─────────────────────────────────────────────────────────────────
+static int simplify_mode, empty_mode, eps_mode, noneps_mode, uses_mode, alphabet_mode,
+           notusing_mode, infinite_mode, startswith_mode, reverse_mode,
+           endswith_mode, startsset_mode, endsset_mode, prefixes_mode, bsfora_mode, insert_mode, strip_mode,
+           queries_mode, canonical_mode, match_mode, stripword_mode,
+           rstripword_mode, lquot_mode, rquot_mode, equivalent_mode,
+           compile_mode, load_mode, scan_mode, count_mode, cardinality_mode,
+           enumerate_mode, enumupto_mode;
+static char sym = 0;
+static unsigned long long num_arg = 0;     // --count N, --enumerate K, --enumerate-upto N
+static const char* word_arg = NULL;     // --strip-word w, or the quotient regex
+static size_t      word_len = 0;
+
+// --queries: one tab-separated row of answers per line
+typedef enum { Q_EMPTY, Q_EPS, Q_NONEPS, Q_INFINITE,
+               Q_USES, Q_STARTS, Q_ENDS } QueryKind;
+
+typedef struct Query {
+    QueryKind kind;
+    char sym;           // for Q_USES/Q_STARTS/Q_ENDS; '*' = every symbol
+} Query;
+
+#define MAX_QUERIES 256
+static Query queries[MAX_QUERIES];
+static int   nqueries = 0;
+
+// Parse "empty,has-epsilon,uses=a,starts-with=*,..." into queries[].
+static int parse_queries(const char* spec) {
+    static const struct { const char* name; QueryKind kind; int takes_sym; } names[] = {
+        { "empty", Q_EMPTY, 0 },       { "has-epsilon", Q_EPS, 0 },
+        { "has-nonepsilon", Q_NONEPS, 0 }, { "infinite", Q_INFINITE, 0 },
+        { "uses", Q_USES, 1 },         { "starts-with", Q_STARTS, 1 },
+        { "ends-with", Q_ENDS, 1 },
+    };
+    while (*spec) {
+        size_t n = strcspn(spec, ",");
+        size_t name_len = strcspn(spec, ",=");
+        size_t k;
+        for (k = 0; k < sizeof names / sizeof names[0]; k++)
+            if (strlen(names[k].name) == name_len
+                && strncmp(spec, names[k].name, name_len) == 0) break;
+        if (k == sizeof names / sizeof names[0] || nqueries == MAX_QUERIES) {
+            fprintf(stderr, "Error: unknown query '%.*s'\n", (int)n, spec);
+            return 0;
+        }
+        Query* q = &queries[nqueries++];
+        q->kind = names[k].kind;
+        q->sym  = 0;
+        if (names[k].takes_sym) {
+            const char* arg = spec + name_len + 1;
+            if (spec[name_len] != '=' || n != name_len + 2
+                || (*arg != '*' && sym_index(*arg) < 0)) {
+                fprintf(stderr, "Error: query '%.*s' needs =<symbol> or =*\n", (int)n, spec);
+                return 0;
+            }
+            q->sym = *arg;
+        } else if (n != name_len) {
+            fprintf(stderr, "Error: query '%.*s' takes no argument\n", (int)n, spec);
+            return 0;
+        }
+        spec += n;
+        if (*spec == ',') spec++;
+    }
+    return 1;
+}
+
+// A yes/no for one symbol, or the member symbols (in index order) for '*';
+// an empty set prints as "/".
+static void print_symset(SymSet set, char sym) {
+    if (sym != '*') {
+        out_str(out, (set & sym_bit(sym)) ? "yes" : "no");
+        return;
+    }
+    if (!set) { out_byte(out, '/'); return; }
+    for (int i = 0; i < 64; i++)
+        if (set & ((SymSet)1 << i)) out_byte(out, index_sym(i));
+}
+
+static void print_queries(RegexNode* tree) {
+    Attrs a;
+    analyze(tree, &a);
+    for (int i = 0; i < nqueries; i++) {
+        if (i) out_byte(out, '\t');
+        switch (queries[i].kind) {
+          case Q_EMPTY:    out_str(out, a.empty    ? "yes" : "no"); break;
+          case Q_EPS:      out_str(out, a.eps      ? "yes" : "no"); break;
+          case Q_NONEPS:   out_str(out, a.noneps   ? "yes" : "no"); break;
+          case Q_INFINITE: out_str(out, a.infinite ? "yes" : "no"); break;
+          case Q_USES:     print_symset(a.uses,  queries[i].sym); break;
+          case Q_STARTS:   print_symset(a.first, queries[i].sym); break;
+          case Q_ENDS:     print_symset(a.last,  queries[i].sym); break;
+        }
+    }
+    out_byte(out, '\n');
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --stats[=json]: per-line cost accounting
+//
+// For each line: nodes built by the parser, make_node and clone_tree
+// calls, nodes printed, the most nodes alive at once (the store only
+// grows within a line, so that is its size at the end) and the time
+// taken.  The counters above are plain increments; everything else
+// hides behind `if (stats_mode)` tests made once per line, so the flag
+// can stay compiled in.  Records go to stderr or --stats-file=PATH, in input
+// order under --jobs too, followed by a total that also counts the lines
+// answered by the cross-line memo and by --cache.
+// ─────────────────────────────────────────────────────────────────
+typedef enum { STATS_OFF, STATS_TEXT, STATS_JSON } StatsMode;
+
+static StatsMode stats_mode = STATS_OFF;
+static int       stats_fd   = STDERR_FILENO;
+
+typedef struct LineStats {
+    unsigned long parsed, made, cloned, printed, peak;
+    unsigned long memo, cached;         // lines answered by the memo, --cache
+    unsigned long long ns;
+} LineStats;
+
+static _Thread_local unsigned long print_nodes = 0;
+static _Thread_local unsigned long memo_hits = 0, cache_hits = 0;
+static _Thread_local LineStats     stats_total;      // peak is the largest line's
+static _Thread_local OutBuf*       stats_out;
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static unsigned long sat_add(unsigned long a, unsigned long b) {
+    return b > ULONG_MAX - a ? ULONG_MAX : a + b;
+}
+
+static void stats_add(LineStats* total, const LineStats* s) {
+    total->parsed  = sat_add(total->parsed,  s->parsed);
+    total->made    = sat_add(total->made,    s->made);
+    total->cloned  = sat_add(total->cloned,  s->cloned);
+    total->printed = sat_add(total->printed, s->printed);
+    total->memo    = sat_add(total->memo,    s->memo);
+    total->cached  = sat_add(total->cached,  s->cached);
+    if (s->peak > total->peak) total->peak = s->peak;
+    total->ns += s->ns;
+}
+
+// One record; `line` 0 is the total over `nlines` lines.
+static void stats_print(OutBuf* o, unsigned long line, unsigned long nlines, const LineStats* s) {
+    char buf[320];
+    if (stats_mode == STATS_JSON && line)
+        snprintf(buf, sizeof buf,
+                 "{\"line\":%lu,\"parsed\":%lu,\"make_node\":%lu,\"clone_tree\":%lu,"
+                 "\"output\":%lu,\"peak\":%lu,\"ns\":%llu}\n",
+                 line, s->parsed, s->made, s->cloned, s->printed, s->peak, s->ns);
+    else if (stats_mode == STATS_JSON)
+        snprintf(buf, sizeof buf,
+                 "{\"lines\":%lu,\"parsed\":%lu,\"make_node\":%lu,\"clone_tree\":%lu,"
+                 "\"output\":%lu,\"peak\":%lu,\"memo_hits\":%lu,\"cache_hits\":%lu,"
+                 "\"ns\":%llu}\n",
+                 nlines, s->parsed, s->made, s->cloned, s->printed, s->peak,
+                 s->memo, s->cached, s->ns);
+    else if (line)
+        snprintf(buf, sizeof buf,
+                 "stats: line %lu: parsed %lu, make_node %lu, clone_tree %lu, "
+                 "output %lu, peak %lu, %.3f ms\n",
+                 line, s->parsed, s->made, s->cloned, s->printed, s->peak, s->ns / 1e6);
+    else
+        snprintf(buf, sizeof buf,
+                 "stats: total: %lu lines, parsed %lu, make_node %lu, clone_tree %lu, "
+                 "output %lu, largest peak %lu, memo hits %lu (%.1f%%), "
+                 "cache hits %lu (%.1f%%), %.3f ms\n",
+                 nlines, s->parsed, s->made, s->cloned, s->printed, s->peak,
+                 s->memo, nlines ? 100.0 * s->memo / nlines : 0.0,
+                 s->cached, nlines ? 100.0 * s->cached / nlines : 0.0, s->ns / 1e6);
+    out_str(o, buf);
+}
+
+// Counter readings before a line, turned into the line's record after it.
+static void stats_begin(LineStats* mark) {
+    mark->parsed  = parse_nodes;
+    mark->made    = make_calls;
+    mark->cloned  = clone_calls;
+    mark->printed = print_nodes;
+    mark->memo    = memo_hits;
+    mark->cached  = cache_hits;
+    mark->ns      = now_ns();
+}
+
+static void stats_end(const LineStats* mark, unsigned long line) {
+    LineStats s = {
+        parse_nodes - mark->parsed, make_calls - mark->made,
+        clone_calls - mark->cloned, print_nodes - mark->printed,
+        store_count, memo_hits - mark->memo, cache_hits - mark->cached,
+        now_ns() - mark->ns,
+    };
+    stats_add(&stats_total, &s);
+    stats_print(stats_out, line, 0, &s);
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --cache DIR: persistent results across runs
+//
+// A line's output is stored under its tree, written out in postfix,
+// and a fingerprint of the mode and every option that changes output,
+// so the same tree hits whatever notation it came in.  Slots are found
+// by the tree's structural hash and confirmed by comparing the stored
+// postfix.  Lines whose output was flushed mid-answer are not stored.
+// DIR holds three files:
+//
+//   lock    flock(2) target; never replaced
+//   index   CacheHeader, then an open-addressing table of CacheSlot
+//   data    per entry, the key then the output
+//
+// A run holds a shared lock throughout and maps index and data
+// read-only (the LRU stamp of a slot that hits is the one shared
+// write).  New results collect in memory per thread, and at exit the
+// run takes the exclusive lock and appends them.  If the data would
+// pass --cache-max=MB (default 256), or the table is half full, both
+// files are rewritten with the most recently used entries that fill
+// half the budget, and renamed into place.  flock converts a shared
+// lock to an exclusive one by dropping it first, so two runs finishing
+// together cannot deadlock.
+// ─────────────────────────────────────────────────────────────────
+#define CACHE_MAGIC   "RXTCACHE"
+#define CACHE_VERSION 2
+
+typedef struct CacheHeader {
+    char     magic[8];
+    uint32_t version, nslots;   // nslots: a power of two
+    uint64_t clock;             // bumped by each run; the LRU time
+    uint64_t data_len;          // bytes of data in use
+    uint64_t count;             // slots in use, always below nslots
+} CacheHeader;
+
+typedef struct CacheSlot {
+    uint64_t hash, mode;        // hash == 0: empty slot
+    uint32_t key_len, len;      // bytes of key, then of output, at off
+    uint64_t off, used;         // offset in data; clock of the last hit
+} CacheSlot;
+
+static const char*  cache_dir = NULL;
+static uint64_t     cache_max = 256ULL << 20;
+static uint64_t     cache_mode_fp = 0;
+static int          cache_lock_fd = -1;
+static CacheHeader* cache_index = NULL;     // read-only mapping but for `used`
+static size_t       cache_index_size = 0;
+static const char*  cache_data = NULL;
+static size_t       cache_data_size = 0;
+static uint64_t     cache_clock = 0;
+
+// Results found this run, per thread, merged at exit.
+typedef struct CachePending {
+    CacheSlot* slots;           // off is into bytes
+    size_t     n, cap;
+    char*      bytes;
+    size_t     len, bytes_cap;
+} CachePending;
+
+static _Thread_local CachePending cache_new;
+static CachePending cache_all;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t bytes_hash(uint64_t h, const void* p, size_t n) {
+    const unsigned char* b = p;
+    for (size_t i = 0; i < n; i++) h = (h ^ b[i]) * 0x100000001B3ULL;
+    return h;
+}
+
+// The key bytes of a tree: its postfix form, in tree_key.
+static _Thread_local OutBuf tree_key = { NULL, 0, 0, -1, 0 };
+
+static void tree_key_of(RegexNode* tree) {
+    OutBuf* saved = out;
+    out = &tree_key;
+    tree_key.len = 0;
+    print_postfix(tree);
+    out = saved;
+}
+
+// Everything besides the tree that shapes a line's output: the mode,
+// its argument and flags (not those that only affect speed or
+// reporting), for --match the strings, and for the quotients the
+// second regex as parsed under --in.
+static uint64_t cache_fingerprint(int argc, char* argv[]) {
+    uint64_t h = bytes_hash(0xCBF29CE484222325ULL, CACHE_MAGIC, 8) + CACHE_VERSION;
+    int quotient = lquot_mode || rquot_mode;
+    for (int i = 1; i < argc; i++) {
+        if (i == 2 && quotient) continue;
+        if (strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "--cache") == 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--alloc-stats") == 0 || strncmp(argv[i], "--stats", 7) == 0
+            || strcmp(argv[i], "--memo") == 0
+            || strncmp(argv[i], "--cache-max=", 12) == 0 || strncmp(argv[i], "--engine=", 9) == 0
+            || strncmp(argv[i], "--in=", 5) == 0)
+            continue;
+        h = bytes_hash(h, argv[i], strlen(argv[i]) + 1);
+    }
+    if (match_mode) {
+        h = bytes_hash(h, match_text, match_text_len);
+        h = bytes_hash(h, match_end, match_count * sizeof *match_end);
+    }
+    if (quotient) {
+        RegexNode* r2 = parse_line(word_arg, word_len);
+        tree_key.len = 0;
+        if (r2) tree_key_of(r2);
+        h = bytes_hash(h, tree_key.data, tree_key.len) + (r2 != NULL);
+        store_reset();
+    }
+    return h;
+}
+
+static int cache_path(char* buf, size_t size, const char* name) {
+    return snprintf(buf, size, "%s/%s", cache_dir, name) < (int)size;
+}
+
+static void* cache_map(const char* name, size_t* size, int prot) {
+    char path[4096];
+    struct stat st;
+    *size = 0;
+    if (!cache_path(path, sizeof path, name)) return NULL;
+    int fd = open(path, prot & PROT_WRITE ? O_RDWR : O_RDONLY);
+    if (fd < 0) return NULL;
+    void* p = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        p = mmap(NULL, (size_t)st.st_size, prot, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) p = NULL;
+        else *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return p;
+}
+
+static void cache_unmap(void) {
+    if (cache_index) munmap(cache_index, cache_index_size);
+    if (cache_data)  munmap((void*)cache_data, cache_data_size);
+    cache_index = NULL;
+    cache_data  = NULL;
+    cache_index_size = cache_data_size = 0;
+}
+
+// Map index and data, checking the header; on any mismatch the cache
+// is treated as empty (and rebuilt at exit).
+static void cache_map_all(void) {
+    cache_index = cache_map("index", &cache_index_size, PROT_READ | PROT_WRITE);
+    cache_data  = cache_map("data",  &cache_data_size,  PROT_READ);
+    CacheHeader* h = cache_index;
+    if (!h || cache_index_size < sizeof *h
+        || memcmp(h->magic, CACHE_MAGIC, sizeof h->magic) != 0
+        || h->version != CACHE_VERSION || !h->nslots || (h->nslots & (h->nslots - 1))
+        || cache_index_size < sizeof *h + (size_t)h->nslots * sizeof(CacheSlot)
+        || h->count >= h->nslots || h->data_len > cache_data_size)
+        cache_unmap();
+}
+
+static CacheSlot* cache_slots(void) {
+    return (CacheSlot*)(cache_index + 1);
+}
+
+// The slot holding a key, whose entry must lie in data[0, data_len);
+// else the empty slot where it would go; else, after nslots tries (a
+// full or damaged table), NULL.
+static CacheSlot* slot_probe(CacheSlot* slots, uint32_t nslots, const char* data,
+                             uint64_t data_len, uint64_t hash, uint64_t mode,
+                             const char* key, uint32_t key_len) {
+    uint32_t mask = nslots - 1, i = (uint32_t)hash & mask;
+    for (uint32_t tries = 0; tries < nslots; tries++, i = (i + 1) & mask) {
+        CacheSlot* s = &slots[i];
+        if (!s->hash) return s;
+        if (s->hash == hash && s->mode == mode && s->key_len == key_len
+            && s->off <= data_len && (uint64_t)key_len + s->len <= data_len - s->off
+            && memcmp(data + s->off, key, key_len) == 0)
+            return s;
+    }
+    return NULL;
+}
+
+static CacheSlot* cache_find(uint64_t hash, uint64_t mode, const char* key, uint32_t key_len) {
+    if (!cache_index) return NULL;
+    uint64_t limit = cache_index->data_len < cache_data_size
+                   ? cache_index->data_len : cache_data_size;
+    CacheSlot* s = slot_probe(cache_slots(), cache_index->nslots, cache_data, limit,
+                              hash, mode, key, key_len);
+    return s && s->hash ? s : NULL;
+}
+
+static int cache_lock_file(int op) {
+    while (flock(cache_lock_fd, op) != 0)
+        if (errno != EINTR) return 0;
+    return 1;
+}
+
+static int cache_open(void) {
+    char path[4096];
+    mkdir(cache_dir, 0777);
+    if (!cache_path(path, sizeof path, "lock")
+        || (cache_lock_fd = open(path, O_RDWR | O_CREAT, 0666)) < 0
+        || !cache_lock_file(LOCK_SH)) {
+        fprintf(stderr, "Error: cannot use cache directory %s\n", cache_dir);
+        return 0;
+    }
+    cache_map_all();
+    if (cache_index)
+        cache_clock = __atomic_add_fetch(&cache_index->clock, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Copy the stored result for tree, whose key is in tree_key, to out.
+static int cache_get(RegexNode* tree) {
+    CacheSlot* s = cache_find(tree->hash | 1, cache_mode_fp, tree_key.data, (uint32_t)tree_key.len);
+    if (!s) return 0;
+    __atomic_store_n(&s->used, cache_clock, __ATOMIC_RELAXED);
+    if (out->cap - out->len < s->len) out_make_room(out, s->len);
+    memcpy(out->data + out->len, cache_data + s->off + s->key_len, s->len);
+    out->len += s->len;
+    return 1;
+}
+
+// Keep out[at ..] as the result for tree (key in tree_key), unless the
+// buffer was flushed in the meantime or the entry would be a large
+// share of the budget.
+static void cache_put(RegexNode* tree, size_t at, size_t flushed) {
+    size_t len = out->len - at, key_len = tree_key.len;
+    CachePending* p = &cache_new;
+    if (out->flushed != flushed || key_len + len > cache_max / 16
+        || p->len + key_len + len > cache_max)
+        return;
+    if (p->n == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 256;
+        p->slots = xrealloc(p->slots, p->cap * sizeof *p->slots);
+    }
+    if (p->len + key_len + len > p->bytes_cap) {
+        while (p->len + key_len + len > p->bytes_cap)
+            p->bytes_cap = p->bytes_cap ? p->bytes_cap * 2 : 65536;
+        p->bytes = xrealloc(p->bytes, p->bytes_cap);
+    }
+    CacheSlot* s = &p->slots[p->n++];
+    s->hash    = tree->hash | 1;
+    s->mode    = cache_mode_fp;
+    s->key_len = (uint32_t)key_len;
+    s->len     = (uint32_t)len;
+    s->off     = p->len;
+    s->used    = 0;
+    memcpy(p->bytes + p->len, tree_key.data, key_len);
+    memcpy(p->bytes + p->len + key_len, out->data + at, len);
+    p->len += key_len + len;
+}
+
+static size_t slot_bytes(const CacheSlot* s) {
+    return (size_t)s->key_len + s->len;
+}
+
+// Move this thread's new results into cache_all.
+static void cache_merge(void) {
+    CachePending* p = &cache_new;
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < p->n; i++) {
+        if (cache_all.n == cache_all.cap) {
+            cache_all.cap = cache_all.cap ? cache_all.cap * 2 : 256;
+            cache_all.slots = xrealloc(cache_all.slots, cache_all.cap * sizeof *cache_all.slots);
+        }
+        size_t n = slot_bytes(&p->slots[i]);
+        if (cache_all.len + n > cache_all.bytes_cap) {
+            while (cache_all.len + n > cache_all.bytes_cap)
+                cache_all.bytes_cap = cache_all.bytes_cap ? cache_all.bytes_cap * 2 : 65536;
+            cache_all.bytes = xrealloc(cache_all.bytes, cache_all.bytes_cap);
+        }
+        CacheSlot* s = &cache_all.slots[cache_all.n++];
+        *s = p->slots[i];
+        memcpy(cache_all.bytes + cache_all.len, p->bytes + s->off, n);
+        s->off = cache_all.len;
+        cache_all.len += n;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    free(p->slots);
+    free(p->bytes);
+    memset(p, 0, sizeof *p);
+}
+
+static int write_file(const char* name, const void* a, size_t alen, const void* b, size_t blen) {
+    char tmp[4096], path[4096];
+    if (!cache_path(path, sizeof path, name)
+        || snprintf(tmp, sizeof tmp, "%s.%ld", path, (long)getpid()) >= (int)sizeof tmp)
+        return 0;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return 0;
+    struct iovec v[2] = { { (void*)a, alen }, { (void*)b, blen } };
+    write_all_iov(fd, v, 2);
+    if (close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+static int slot_newer(const void* a, const void* b) {
+    uint64_t x = (*(CacheSlot* const*)a)->used, y = (*(CacheSlot* const*)b)->used;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int slot_order(const void* a, const void* b) {
+    const CacheSlot *x = *(CacheSlot* const*)a, *y = *(CacheSlot* const*)b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    if (x->mode != y->mode) return x->mode < y->mode ? -1 : 1;
+    if (x->key_len != y->key_len) return x->key_len < y->key_len ? -1 : 1;
+    return memcmp(cache_all.bytes + x->off, cache_all.bytes + y->off, x->key_len);
+}
+
+// Threads may have answered the same regex: keep one entry per key in
+// cache_all, emptying the others.
+static void cache_dedupe(void) {
+    CacheSlot** by = xmalloc((cache_all.n + 1) * sizeof *by);
+    for (size_t i = 0; i < cache_all.n; i++) by[i] = &cache_all.slots[i];
+    qsort(by, cache_all.n, sizeof *by, slot_order);
+    for (size_t i = 1; i < cache_all.n; i++)
+        if (slot_order(&by[i - 1], &by[i]) == 0) by[i - 1]->hash = 0;
+    free(by);
+}
+
+// Write fresh index and data files holding the newest entries -- this
+// run's, then the old ones by last use -- up to `budget` bytes.
+static void cache_rewrite(uint64_t budget) {
+    size_t old = cache_index ? cache_index->nslots : 0, nall = 0;
+    CacheSlot** all = xmalloc((old + cache_all.n + 1) * sizeof *all);
+    for (size_t i = 0; i < cache_all.n; i++) {
+        if (!cache_all.slots[i].hash) continue;
+        cache_all.slots[i].used = UINT64_MAX;       // sorts first
+        all[nall++] = &cache_all.slots[i];
+    }
+    uint64_t limit = !old ? 0 : cache_index->data_len < cache_data_size
+                   ? cache_index->data_len : cache_data_size;
+    for (size_t i = 0; i < old; i++) {
+        CacheSlot* s = &cache_slots()[i];
+        if (s->hash && s->off <= limit && slot_bytes(s) <= limit - s->off) all[nall++] = s;
+    }
+    qsort(all, nall, sizeof *all, slot_newer);
+
+    size_t keep = 0;
+    uint64_t bytes = 0;
+    while (keep < nall && bytes + slot_bytes(all[keep]) <= budget) bytes += slot_bytes(all[keep++]);
+    uint32_t nslots = 1024;
+    while (nslots < 4 * keep) nslots *= 2;
+    size_t isize = sizeof(CacheHeader) + (size_t)nslots * sizeof(CacheSlot);
+    CacheHeader* h = xcalloc(1, isize);
+    CacheSlot* slots = (CacheSlot*)(h + 1);
+    char* data = xmalloc(bytes + 1);
+    memcpy(h->magic, CACHE_MAGIC, sizeof h->magic);
+    h->version = CACHE_VERSION;
+    h->nslots  = nslots;
+    h->clock   = cache_clock;
+    for (size_t k = 0; k < keep; k++) {
+        CacheSlot* s = all[k];
+        const char* src = (s >= cache_all.slots && s < cache_all.slots + cache_all.n)
+                        ? cache_all.bytes + s->off : cache_data + s->off;
+        CacheSlot* t = slot_probe(slots, nslots, data, h->data_len,
+                                  s->hash, s->mode, src, s->key_len);
+        if (!t || t->hash) continue;                // a duplicate
+        *t = *s;
+        t->off  = h->data_len;
+        t->used = s->used == UINT64_MAX ? cache_clock : s->used;
+        memcpy(data + h->data_len, src, slot_bytes(s));
+        h->data_len += slot_bytes(s);
+        h->count++;
+    }
+    // data first: the index names only bytes already in place
+    if (!write_file("data", data, h->data_len, NULL, 0)
+        || !write_file("index", h, isize, NULL, 0))
+        fprintf(stderr, "Error: cannot update cache in %s\n", cache_dir);
+    free(all);
+    free(h);
+    free(data);
+}
+
+// Store this run's results, then let go of the cache.
+static void cache_close(void) {
+    cache_merge();
+    if (cache_all.n) {
+        cache_dedupe();
+        cache_unmap();
+        if (cache_lock_file(LOCK_EX)) {             // drops the shared lock first
+            cache_map_all();
+            if (!cache_clock) cache_clock = 1;
+            size_t fresh = 0, bytes = 0;
+            for (size_t i = 0; i < cache_all.n; i++) {
+                CacheSlot* s = &cache_all.slots[i];
+                if (s->hash && !cache_find(s->hash, s->mode, cache_all.bytes + s->off, s->key_len)) {
+                    fresh++;
+                    bytes += slot_bytes(s);
+                }
+            }
+            if (!cache_index || 2 * (cache_index->count + fresh) > cache_index->nslots
+                || cache_index->data_len + bytes > cache_max) {
+                cache_rewrite(cache_index && cache_index->data_len + bytes > cache_max
+                              ? cache_max / 2 : cache_max);
+            } else if (fresh) {
+                // Room in place: append the bytes, then fill in the slots.
+                char path[4096];
+                int fd = cache_path(path, sizeof path, "data") ? open(path, O_WRONLY) : -1;
+                uint64_t at = cache_index->data_len;
+                for (size_t i = 0; fd >= 0 && i < cache_all.n; i++) {
+                    CacheSlot* s = &cache_all.slots[i];
+                    if (!s->hash) continue;
+                    CacheSlot* t = slot_probe(cache_slots(), cache_index->nslots, cache_data,
+                                              cache_index->data_len < cache_data_size
+                                              ? cache_index->data_len : cache_data_size,
+                                              s->hash, s->mode, cache_all.bytes + s->off, s->key_len);
+                    if (!t) break;
+                    if (t->hash) continue;
+                    size_t n = slot_bytes(s);
+                    if (pwrite(fd, cache_all.bytes + s->off, n, (off_t)at) != (ssize_t)n) break;
+                    *t = *s;
+                    t->off  = at;
+                    t->used = cache_clock;
+                    at += n;
+                    cache_index->data_len = at;
+                    cache_index->count++;
+                }
+                if (fd >= 0) close(fd);
+            }
+        }
+    }
+    cache_unmap();
+    flock(cache_lock_fd, LOCK_UN);
+    close(cache_lock_fd);
+}
+
+// ─────────────────────────────────────────────────────────────────
+// Cross-line memo: repeated regexes within one run
+//
+// Batches repeat whole regexes, so with --memo each thread remembers
+// the output of every line it has answered and copies it when the
+// regex comes round again.  Outputs are filed twice: under the line's
+// exact text, which skips even the parse, and under the tree's postfix
+// form (the --cache key), which catches the regex written differently.
+// Subterms shared between different lines are not memoized: their
+// nodes die with the line's store, and within a line hash-consing
+// already shares them and the boolean attributes are cached on the
+// nodes.  One budget of MEMO_MAX_BYTES and MEMO_MAX_SLOTS is split
+// evenly between the threads; each allocates its share once, on its
+// first stored line, and starts over when the share fills.
+// ─────────────────────────────────────────────────────────────────
+#define MEMO_MAX_BYTES (64u << 20)     // all threads together
+#define MEMO_MAX_SLOTS (1u << 17)
+
+typedef struct MemoSlot {
+    unsigned long hash;         // 0: empty
+    uint32_t      tree;         // 0: keyed by text, 1: by the tree
+    uint32_t      len, key_len;
+    size_t        off, key_off; // into memo_bytes
+} MemoSlot;
+
+static int    memo_on = 0;
+static size_t memo_max = MEMO_MAX_BYTES;   // this thread's share
+static size_t memo_nslots = MEMO_MAX_SLOTS; // a power of two, at most half in use
+static _Thread_local MemoSlot* memo_slots = NULL;
+static _Thread_local size_t    memo_count = 0;
+static _Thread_local char*     memo_bytes = NULL;
+static _Thread_local size_t    memo_len = 0;
+
+// The slot for a key, or the empty slot where it would go.
+static MemoSlot* memo_probe(unsigned long hash, uint32_t tree, const char* key, size_t key_len) {
+    for (size_t i = hash & (memo_nslots - 1);; i = (i + 1) & (memo_nslots - 1)) {
+        MemoSlot* m = &memo_slots[i];
+        if (!m->hash || (m->hash == hash && m->tree == tree && m->key_len == key_len
+                         && memcmp(memo_bytes + m->key_off, key, key_len) == 0))
+            return m;
+    }
+}
+
+// Copy the remembered output for a key to out, if there is one.
+static int memo_get(unsigned long hash, uint32_t tree, const char* key, size_t key_len) {
+    if (!memo_count) return 0;
+    MemoSlot* m = memo_probe(hash, tree, key, key_len);
+    if (!m->hash) return 0;
+    if (out->cap - out->len < m->len) out_make_room(out, m->len);
+    memcpy(out->data + out->len, memo_bytes + m->off, m->len);
+    out->len += m->len;
+    return 1;
+}
+
+static size_t memo_keep(const char* bytes, size_t len) {
+    memcpy(memo_bytes + memo_len, bytes, len);
+    memo_len += len;
+    return memo_len - len;
+}
+
+static void memo_add(unsigned long hash, uint32_t tree, const char* key, size_t key_len,
+                     size_t off, size_t len) {
+    MemoSlot* m = memo_probe(hash, tree, key, key_len);
+    if (m->hash) return;
+    m->hash    = hash;
+    m->tree    = tree;
+    m->len     = (uint32_t)len;
+    m->off     = off;
+    m->key_len = (uint32_t)key_len;
+    m->key_off = memo_keep(key, key_len);
+    memo_count++;
+}
+
+// File out[at ..] under the line's text and its tree (key in
+// tree_key); as cache_put.
+static void memo_put(unsigned long text_hash, const char* line, size_t len,
+                     RegexNode* tree, size_t at, size_t flushed) {
+    size_t n = out->len - at, need = n + len + tree_key.len;
+    if (out->flushed != flushed || need > memo_max / 16) return;
+    if (!memo_slots) {
+        memo_slots = xcalloc(memo_nslots, sizeof *memo_slots);
+        memo_bytes = xmalloc(memo_max);
+    }
+    if (memo_len + need > memo_max || 2 * (memo_count + 2) > memo_nslots) {
+        memset(memo_slots, 0, memo_nslots * sizeof *memo_slots);
+        memo_count = memo_len = 0;
+    }
+    size_t off = memo_keep(out->data + at, n);
+    memo_add(text_hash, 0, line, len, off, n);
+    memo_add(tree->hash | 1, 1, tree_key.data, tree_key.len, off, n);
+}
+
+// Split the budget between `threads` threads.
+static void memo_share(int threads) {
+    memo_max = MEMO_MAX_BYTES / (size_t)threads;
+    while (memo_nslots > 1024 && memo_nslots * (size_t)threads > MEMO_MAX_SLOTS)
+        memo_nslots /= 2;
+}
+
+static void memo_free(void) {
+    free(memo_slots);
+    free(memo_bytes);
+    memo_slots = NULL;
+    memo_bytes = NULL;
+    memo_count = memo_len = 0;
+}
+
+// Run the selected mode on one postfix line and print its answer.
+// --size-report: printed size of every result against its input.
+// Totals saturate; worst is the largest single-line growth factor.
+static int size_report = 0;
+static _Thread_local unsigned long size_in = 0, size_out = 0;
+static _Thread_local double        size_worst = 0;
+
+static void print_result(RegexNode* in, RegexNode* res) {
+    if (stats_mode) print_nodes = sat_add(print_nodes, tree_size(res));
+    if (size_report) {
+        unsigned long a = tree_size(in), b = tree_size(res);
+        size_in  = a > ULONG_MAX - size_in  ? ULONG_MAX : size_in + a;
+        size_out = b > ULONG_MAX - size_out ? ULONG_MAX : size_out + b;
+        if ((double)b / a > size_worst) size_worst = (double)b / a;
+    }
+    print_regex(res);
+    out_str(out, "\n");
+}
+
+static void process_tree(RegexNode* tree, const char* line, size_t len) {
+    if (queries_mode) {
+        print_queries(tree);
+        return;
+    }
+    if (match_mode) {
+        match_strings(tree);
+        return;
+    }
+    if (compile_mode) {
+        compile_regex(tree);
+        return;
+    }
+    if (count_mode) {
+        print_count(tree, num_arg);
+        return;
+    }
+    if (cardinality_mode) {
+        print_cardinality(tree);
+        return;
+    }
+    if (enumerate_mode || enumupto_mode) {
+        print_enumeration(tree, num_arg, enumupto_mode);
+        return;
+    }
+    if (equivalent_mode) {
+        if (!eq_have_pending) {
+            if (len > eq_pending_cap) {
+                eq_pending_cap = len * 2;
+                eq_pending = xrealloc(eq_pending, eq_pending_cap);
+            }
+            memcpy(eq_pending, line, len);
+            eq_pending_len = len;
+            eq_have_pending = 1;
+            return;
+        }
+        eq_have_pending = 0;
+        print_equivalent(parse_line(eq_pending, eq_pending_len), tree);
+        return;
+    }
+    if (stripword_mode || rstripword_mode) {
+        print_result(tree, stripword_mode ? strip_word(tree, word_arg, word_len)
+                                          : right_strip_word(tree, word_arg, word_len));
+        return;
+    }
+    if (lquot_mode || rquot_mode) {
+        RegexNode* r2 = parse_line(word_arg, word_len);
+        if (!r2) r2 = make_node(NODE_EMPTY, 0, NULL, NULL);
+        print_result(tree, lquot_mode ? left_quotient(tree, r2) : right_quotient(tree, r2));
+        return;
+    }
+    if (empty_mode) {
+        out_str(out, is_empty(tree) ? "yes\n":"no\n");
+        return;
+    }
+    if (eps_mode) {
+        out_str(out, has_epsilon(tree) ? "yes\n":"no\n");
+        return;
+    }
+    if (noneps_mode) {
+        out_str(out, has_nonepsilon(tree) ? "yes\n":"no\n");
+        return;
+    }
+    if (simplify_mode) {
+        print_result(tree, simplify(tree));
+        return;
+    }
+    if (canonical_mode) {
+        print_result(tree, canonical(tree));
+        return;
+    }
+    if (uses_mode) {
+        out_str(out, uses_symbol(tree,sym) ? "yes\n":"no\n");
+        return;
+    }
+    if (alphabet_mode) {
+        print_alphabet(tree);
+        return;
+    }
+    if (notusing_mode) {
+        print_result(tree, not_using(tree,sym));
+        return;
+    }
+    if (infinite_mode) {
+        out_str(out, is_infinite(tree) ? "yes\n":"no\n");
+        return;
+    }
+    if (startswith_mode) {
+        out_str(out, starts_with(tree,sym) ? "yes\n":"no\n");
+        return;
+    }
+    if (reverse_mode) {
+        print_result(tree, reverse_regex(tree));
+        return;
+    }
+    if (endswith_mode) {
+        out_str(out, ends_with(tree, sym) ? "yes\n" : "no\n");
+        return;
+    }
+    if (startsset_mode || endsset_mode) {
+        SymSet first, last;
+        first_last(tree, &first, &last);
+        print_symset(startsset_mode ? first : last, '*');
+        out_byte(out, '\n');
+        return;
+    }
+    if (prefixes_mode) {
+        print_result(tree, prefixes(tree));
+        return;
+    }
+    if (bsfora_mode) {
+        print_result(tree, bs_for_a(tree));
+        return;
+    }
+    if (strip_mode) {
+        print_result(tree, strip_symbol(tree, sym));
+        return;
+    }
+    if (insert_mode) {
+        print_result(tree, insert_symbol(tree, sym));
+        return;
+    }
+
+    // Default: --no-op
+    if (stats_mode) print_nodes = sat_add(print_nodes, tree_size(tree));
+    print_regex(tree);
+    out_str(out, "\n");
+}
+
+static void process_line(const char* line, size_t len) {
+    unsigned long text_hash = 0;
+    if (memo_on) {
+        text_hash = bytes_hash(0xCBF29CE484222325ULL, line, len) | 1;
+        if (memo_get(text_hash, 0, line, len)) {
+            memo_hits++;
+            return;
+        }
+    }
+    RegexNode* tree = parse_line(line, len);
+    if (!tree) return;
+    if (!memo_on && !cache_dir) {
+        process_tree(tree, line, len);
+        return;
+    }
+    size_t at = out->len, flushed = out->flushed;
+    tree_key_of(tree);
+    if (memo_on && memo_get(tree->hash | 1, 1, tree_key.data, tree_key.len)) {
+        memo_hits++;
+    } else if (cache_dir && cache_get(tree)) {
+        cache_hits++;
+    } else {
+        process_tree(tree, line, len);
+        if (cache_dir) cache_put(tree, at, flushed);
+    }
+    if (memo_on) memo_put(text_hash, line, len, tree, at, flushed);
+}
+
+// lines_allocating counts input lines that needed any heap allocation;
+// once the node pool has warmed up it should stop growing.
+static unsigned long lines = 0, lines_allocating = 0;
+
+static void run_line(const char* line, size_t len) {
+    unsigned long before = alloc_calls;
+    LineStats mark;
+    if (stats_mode) stats_begin(&mark);
+    process_line(line, len);
+    if (stats_mode) stats_end(&mark, lines + 1);
+    store_reset();
+    lines++;
+    if (alloc_calls != before) lines_allocating++;
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --scan PATTERNS [CORPUS]: which patterns match each corpus line
+//
+// One lazily built product automaton for all the patterns at once.  A
+// product state is the list of (pattern, derivative state) pairs still
+// alive -- patterns whose derivative went dead drop out -- and its
+// accept set is the patterns whose derivative has ε.  Component states
+// come from the --match tables, shared between patterns, so a corpus
+// byte costs one product lookup once the automaton has warmed up.
+//
+// The patterns' nodes must outlive every line, so scanning runs on the
+// main thread and never resets the node store.  When the product table
+// passes SCAN_MAX_STATES it is dropped at the next line boundary and
+// rebuilt on demand.
+// ─────────────────────────────────────────────────────────────────
+#define SCAN_MAX_STATES 4096
+
+typedef struct ScanState {
+    size_t        pairs;        // offset of its pairs in scan_pairs
+    size_t        accepts;      // offset of its accept set in scan_accepts
+    int           npairs, naccepts;
+    unsigned long hash;
+} ScanState;
+
+static RegexNode** scan_patterns = NULL;    // pattern i+1; NULL if blank
+static size_t      scan_npatterns = 0, scan_patterns_cap = 0;
+static int*        scan_start_pairs = NULL;
+static int         scan_start_npairs = 0;
+
+static ScanState* scan_states = NULL;
+static size_t     scan_nstates = 0, scan_cap = 0;
+static int*       scan_next = NULL;          // [id * 256 + byte]
+static int*       scan_pairs = NULL;         // pattern, component state, ...
+static size_t     scan_pairs_len = 0, scan_pairs_cap = 0;
+static int*       scan_accepts = NULL;       // pattern ids, from 1
+static size_t     scan_accepts_len = 0, scan_accepts_cap = 0;
+static int*       scan_map = NULL;           // pairs → id, linear probing
+static size_t     scan_map_cap = 0;
+static int*       scan_tmp = NULL;           // pairs of the state being built
+static int        scan_start = DFA_UNKNOWN;
+
+static void scan_add_pattern(const char* line, size_t len) {
+    if (scan_npatterns == scan_patterns_cap) {
+        scan_patterns_cap = scan_patterns_cap ? scan_patterns_cap * 2 : 256;
+        scan_patterns = xrealloc(scan_patterns, scan_patterns_cap * sizeof *scan_patterns);
+    }
+    scan_patterns[scan_npatterns++] = parse_line(line, len);
+}
+
+static unsigned long scan_hash(const int* pairs, int n) {
+    unsigned long h = 0x9E3779B97F4A7C15UL;
+    for (int i = 0; i < 2 * n; i++)
+        h = (h ^ (unsigned)pairs[i]) * 0xFF51AFD7ED558CCDUL;
+    return h ^ (h >> 29);
+}
+
+static int scan_lookup(const int* pairs, int n, unsigned long h, size_t* slot) {
+    size_t i = h & (scan_map_cap - 1);
+    for (; scan_map[i] != DFA_UNKNOWN; i = (i + 1) & (scan_map_cap - 1)) {
+        ScanState* s = &scan_states[scan_map[i]];
+        if (s->hash == h && s->npairs == n
+            && memcmp(scan_pairs + s->pairs, pairs, 2 * (size_t)n * sizeof *pairs) == 0)
+            break;
+    }
+    *slot = i;
+    return scan_map[i];
+}
+
+static void scan_map_grow(void) {
+    size_t n = scan_map_cap ? scan_map_cap * 2 : 1024;
+    free(scan_map);
+    scan_map = xmalloc(n * sizeof *scan_map);
+    memset(scan_map, 0xff, n * sizeof *scan_map);
+    scan_map_cap = n;
+    for (size_t id = 0; id < scan_nstates; id++) {
+        ScanState* s = &scan_states[id];
+        size_t slot;
+        scan_lookup(scan_pairs + s->pairs, s->npairs, s->hash, &slot);
+        scan_map[slot] = (int)id;
+    }
+}
+
+// The product state for these (pattern, component) pairs, added if new.
+static int scan_intern(const int* pairs, int n) {
+    if (2 * (scan_nstates + 1) > scan_map_cap) scan_map_grow();
+    unsigned long h = scan_hash(pairs, n);
+    size_t slot;
+    int id = scan_lookup(pairs, n, h, &slot);
+    if (id != DFA_UNKNOWN) return id;
+    if (scan_nstates == scan_cap) {
+        scan_cap = scan_cap ? scan_cap * 2 : 64;
+        scan_states = xrealloc(scan_states, scan_cap * sizeof *scan_states);
+        scan_next   = xrealloc(scan_next,   scan_cap * 256 * sizeof *scan_next);
+    }
+    if (scan_pairs_len + 2 * (size_t)n > scan_pairs_cap) {
+        while (scan_pairs_len + 2 * (size_t)n > scan_pairs_cap)
+            scan_pairs_cap = scan_pairs_cap ? scan_pairs_cap * 2 : 4096;
+        scan_pairs = xrealloc(scan_pairs, scan_pairs_cap * sizeof *scan_pairs);
+    }
+    if (scan_accepts_len + (size_t)n > scan_accepts_cap) {
+        while (scan_accepts_len + (size_t)n > scan_accepts_cap)
+            scan_accepts_cap = scan_accepts_cap ? scan_accepts_cap * 2 : 4096;
+        scan_accepts = xrealloc(scan_accepts, scan_accepts_cap * sizeof *scan_accepts);
+    }
+    id = (int)scan_nstates++;
+    ScanState* s = &scan_states[id];
+    s->pairs    = scan_pairs_len;
+    s->accepts  = scan_accepts_len;
+    s->npairs   = n;
+    s->naccepts = 0;
+    s->hash     = h;
+    memcpy(scan_pairs + scan_pairs_len, pairs, 2 * (size_t)n * sizeof *pairs);
+    scan_pairs_len += 2 * (size_t)n;
+    for (int i = 0; i < n; i++)
+        if (dfa_accept[pairs[2 * i + 1]]) {
+            scan_accepts[scan_accepts_len++] = pairs[2 * i] + 1;
+            s->naccepts++;
+        }
+    scan_map[slot] = id;
+    memset(scan_next + (size_t)id * 256, 0xff, 256 * sizeof *scan_next);
+    return id;
+}
+
+static int scan_step(int s, unsigned char b) {
+    const ScanState* st = &scan_states[s];
+    int n = 0;
+    for (int i = 0; i < st->npairs; i++) {
+        int c = scan_pairs[st->pairs + 2 * i + 1];
+        int t = dfa_next[(size_t)c * 256 + b];
+        if (t == DFA_UNKNOWN) t = dfa_step(c, b);
+        if (t != dfa_dead) {
+            scan_tmp[2 * n]     = scan_pairs[st->pairs + 2 * i];
+            scan_tmp[2 * n + 1] = t;
+            n++;
+        }
+    }
+    int t = scan_intern(scan_tmp, n);    // may move scan_states
+    scan_next[(size_t)s * 256 + b] = t;
+    return t;
+}
+
+// Parse the patterns and intern their start states.  Called once, on
+// the main thread, after the --in flag is known.
+static void scan_prepare(int fd) {
+    read_lines(fd, scan_add_pattern);
+    scan_start_pairs = xmalloc(2 * (scan_npatterns + 1) * sizeof *scan_start_pairs);
+    scan_tmp         = xmalloc(2 * (scan_npatterns + 1) * sizeof *scan_tmp);
+    for (size_t i = 0; i < scan_npatterns; i++) {
+        if (!scan_patterns[i] || is_empty(scan_patterns[i])) continue;
+        scan_start_pairs[2 * scan_start_npairs]     = (int)i;
+        scan_start_pairs[2 * scan_start_npairs + 1] = dfa_intern(canonical(scan_patterns[i]));
+        scan_start_npairs++;
+    }
+}
+
+// Print the ids of the patterns matching one corpus line, tab-separated.
+static void scan_line(const char* line, size_t len) {
+    if (scan_nstates > SCAN_MAX_STATES || scan_start == DFA_UNKNOWN) {
+        scan_nstates = scan_pairs_len = scan_accepts_len = 0;
+        if (scan_map) memset(scan_map, 0xff, scan_map_cap * sizeof *scan_map);
+        scan_start = scan_intern(scan_start_pairs, scan_start_npairs);
+    }
+    int s = scan_start;
+    const unsigned char* p   = (const unsigned char*)line;
+    const unsigned char* end = p + len;
+    for (; p < end && scan_states[s].npairs; p++) {
+        int t = scan_next[(size_t)s * 256 + *p];
+        s = (t != DFA_UNKNOWN) ? t : scan_step(s, *p);
+    }
+    const ScanState* st = &scan_states[s];
+    char buf[16];
+    for (int i = 0; i < st->naccepts; i++) {
+        snprintf(buf, sizeof buf, i ? "\t%d" : "%d", scan_accepts[st->accepts + i]);
+        out_str(out, buf);
+    }
+    out_byte(out, '\n');
+    lines++;
+}
+
+// ─────────────────────────────────────────────────────────────────
+// --jobs N: parallel batch mode
+//
+// The main thread cuts the input into chunks of whole lines and queues
+// them for worker threads.  Each worker has its own node store (all of
+// that state is thread-local) and writes its answers into the chunk's
+// in-memory OutBuf.  Chunks cycle through a ring of slots, and the main
+// thread writes finished chunks strictly in sequence -- as many as are
+// ready in one writev() -- before reusing a slot, so the output is
+// byte-identical to a serial run.  Slot buffers are reused, not freed.
+// ─────────────────────────────────────────────────────────────────
+#define JOB_CHUNK_BYTES (256 * 1024)
+
+typedef struct Chunk {
+    char*   text;               // the chunk's lines, newlines stripped
+    size_t  text_len, text_cap;
+    size_t* ends;               // line i is text[ends[i-1] .. ends[i])
+    size_t  nlines, ends_cap;
+    OutBuf  result;             // the chunk's output (in memory)
+    OutBuf  stats;              // its --stats records (in memory)
+    unsigned long first_line;   // number of its first line, from 1
+    unsigned long lines_allocating;
+    int     done;
+} Chunk;
+
+static Chunk*        job_slots;
+static unsigned long job_nslots;
+static unsigned long job_filled, job_taken, job_written;   // sequence numbers
+static int           job_shutdown;
+static unsigned long job_alloc_calls, job_alloc_bytes;     // summed over workers
+static unsigned long job_size_in, job_size_out;
+static double        job_size_worst;
+static LineStats     job_stats;
+static unsigned long job_lines_queued;
+static pthread_mutex_t job_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  job_done  = PTHREAD_COND_INITIALIZER;
+
+static void* job_worker(void* arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&job_lock);
+        while (job_taken == job_filled && !job_shutdown)
+            pthread_cond_wait(&job_ready, &job_lock);
+        if (job_taken == job_filled) {
+            pthread_mutex_unlock(&job_lock);
+            break;
+        }
+        Chunk* c = &job_slots[job_taken++ % job_nslots];
+        pthread_mutex_unlock(&job_lock);
+
+        out = &c->result;
+        out->len = 0;
+        stats_out = &c->stats;
+        stats_out->len = 0;
+        size_t start = 0;
+        for (size_t i = 0; i < c->nlines; i++) {
+            unsigned long before = alloc_calls;
+            LineStats mark;
+            if (stats_mode) stats_begin(&mark);
+            process_line(c->text + start, c->ends[i] - start);
+            if (stats_mode) stats_end(&mark, c->first_line + i);
+            store_reset();
+            if (alloc_calls != before) c->lines_allocating++;
+            start = c->ends[i];
+        }
+
+        pthread_mutex_lock(&job_lock);
+        c->done = 1;
+        pthread_cond_broadcast(&job_done);
+        pthread_mutex_unlock(&job_lock);
+    }
+    pthread_mutex_lock(&job_lock);
+    job_alloc_calls += alloc_calls;
+    job_alloc_bytes += alloc_bytes;
+    job_size_in  = size_in  > ULONG_MAX - job_size_in  ? ULONG_MAX : job_size_in  + size_in;
+    job_size_out = size_out > ULONG_MAX - job_size_out ? ULONG_MAX : job_size_out + size_out;
+    if (size_worst > job_size_worst) job_size_worst = size_worst;
+    stats_add(&job_stats, &stats_total);
+    pthread_mutex_unlock(&job_lock);
+    if (cache_dir) cache_merge();
+    memo_free();
+    free(tree_key.data);
+    return NULL;
+}
+
+#define JOB_WRITE_BATCH 64
+
+// Write finished chunks, in order, until every sequence number below
+// `upto` has been written.
+static void job_write_until(unsigned long upto) {
+    struct iovec iov[JOB_WRITE_BATCH];
+    while (job_written < upto) {
+        // Wait for the next chunk, then take every finished one after it.
+        pthread_mutex_lock(&job_lock);
+        while (!job_slots[job_written % job_nslots].done)
+            pthread_cond_wait(&job_done, &job_lock);
+        unsigned long end = job_written + 1;
+        while (end < upto && end - job_written < JOB_WRITE_BATCH
+               && job_slots[end % job_nslots].done)
+            end++;
+        pthread_mutex_unlock(&job_lock);
+
+        int n = 0;
+        for (unsigned long i = job_written; i < end; i++) {
+            Chunk* c = &job_slots[i % job_nslots];
+            if (c->result.len > 0) {
+                iov[n].iov_base = c->result.data;
+                iov[n].iov_len  = c->result.len;
+                n++;
+            }
+            lines += c->nlines;
+            lines_allocating += c->lines_allocating;
+        }
+        write_all_iov(STDOUT_FILENO, iov, n);
+        for (unsigned long i = job_written; stats_mode && i < end; i++) {
+            OutBuf* s = &job_slots[i % job_nslots].stats;
+            struct iovec v = { s->data, s->len };
+            write_all_iov(stats_fd, &v, 1);
+        }
+        job_written = end;
+    }
+}
+
+// The slot being filled always belongs to sequence number job_filled.
+static Chunk* job_filling(void) {
+    if (job_filled >= job_nslots)
+        job_write_until(job_filled - job_nslots + 1);
+    return &job_slots[job_filled % job_nslots];
+}
+
+static void job_submit(void) {
+    Chunk* c = job_filling();
+    if (c->nlines == 0) return;
+    pthread_mutex_lock(&job_lock);
+    c->done = 0;
+    job_filled++;
+    pthread_cond_signal(&job_ready);
+    pthread_mutex_unlock(&job_lock);
+    c = job_filling();
+    c->text_len = c->nlines = 0;
+    c->lines_allocating = 0;
+}
+
+static void job_line(const char* line, size_t len) {
+    Chunk* c = job_filling();
+    if (c->text_len + len > c->text_cap) {
+        c->text_cap = (c->text_len + len) * 2;
+        c->text = xrealloc(c->text, c->text_cap);
+    }
+    if (c->nlines == c->ends_cap) {
+        c->ends_cap = c->ends_cap ? c->ends_cap * 2 : 1024;
+        c->ends = xrealloc(c->ends, c->ends_cap * sizeof *c->ends);
+    }
+    if (c->nlines == 0) c->first_line = job_lines_queued + 1;
+    job_lines_queued++;
+    memcpy(c->text + c->text_len, line, len);
+    c->text_len += len;
+    c->ends[c->nlines++] = c->text_len;
+    if (c->text_len >= JOB_CHUNK_BYTES) job_submit();
+}
+
+static void run_jobs(int njobs) {
+    job_nslots = 4 * (unsigned long)njobs;
+    job_slots  = xcalloc(job_nslots, sizeof *job_slots);
+    for (unsigned long i = 0; i < job_nslots; i++)
+        job_slots[i].result.fd = job_slots[i].stats.fd = -1;
+    pthread_t* tids = xmalloc(njobs * sizeof *tids);
+    for (int i = 0; i < njobs; i++)
+        if (pthread_create(&tids[i], NULL, job_worker, NULL) != 0) {
+            fprintf(stderr, "Error: cannot start worker thread\n");
+            exit(1);
+        }
+
+    read_lines(STDIN_FILENO, job_line);
+    job_submit();
+    job_write_until(job_filled);
+
+    pthread_mutex_lock(&job_lock);
+    job_shutdown = 1;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&job_lock);
+    for (int i = 0; i < njobs; i++)
+        pthread_join(tids[i], NULL);
+    alloc_calls += job_alloc_calls;
+    alloc_bytes += job_alloc_bytes;
+    size_in    = job_size_in;
+    size_out   = job_size_out;
+    size_worst = job_size_worst;
+    stats_total = job_stats;
+
+    for (unsigned long i = 0; i < job_nslots; i++) {
+        free(job_slots[i].text);
+        free(job_slots[i].ends);
+        free(job_slots[i].result.data);
+        free(job_slots[i].stats.data);
+    }
+    free(job_slots);
+    free(tids);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s --<option> [symbol | word | regex | query-list | file | number] [--in=FMT] [--out=FMT] [--compact] [--engine=dfa|glushkov] [--jobs N] [--alloc-stats] [--size-report] [--stats[=json]] [--stats-file=PATH] [--cache DIR] [--cache-max=MB] [--memo]\n", argv[0]);
+        return 1;
+    }
+    // Determine mode
+    simplify_mode    = strcmp(argv[1], "--simplify")     == 0;
+    empty_mode       = strcmp(argv[1], "--empty")        == 0;
+    eps_mode         = strcmp(argv[1], "--has-epsilon")  == 0;
+    noneps_mode      = strcmp(argv[1], "--has-nonepsilon")== 0;
+    uses_mode        = strcmp(argv[1], "--uses")         == 0;
+    notusing_mode    = strcmp(argv[1], "--not-using")    == 0;
+    alphabet_mode    = strcmp(argv[1], "--alphabet")     == 0;
+    infinite_mode    = strcmp(argv[1], "--infinite")     == 0;
+    startswith_mode  = strcmp(argv[1], "--starts-with")  == 0;
+    reverse_mode     = strcmp(argv[1], "--reverse")      == 0;
+    endswith_mode    = strcmp(argv[1], "--ends-with")    == 0;
+    startsset_mode   = strcmp(argv[1], "--starts-with-set") == 0;
+    endsset_mode     = strcmp(argv[1], "--ends-with-set")   == 0;
+    prefixes_mode    = strcmp(argv[1], "--prefixes")     == 0;
+    bsfora_mode      = strcmp(argv[1], "--bs-for-a")     == 0;
+    insert_mode      = strcmp(argv[1], "--insert")       == 0;
+    strip_mode       = strcmp(argv[1], "--strip")        == 0;
+    queries_mode     = strcmp(argv[1], "--queries")      == 0;
+    canonical_mode   = strcmp(argv[1], "--canonical")    == 0;
+    match_mode       = strcmp(argv[1], "--match")        == 0;
+    stripword_mode   = strcmp(argv[1], "--strip-word")   == 0;
+    rstripword_mode  = strcmp(argv[1], "--right-strip-word") == 0;
+    lquot_mode       = strcmp(argv[1], "--left-quotient")  == 0;
+    rquot_mode       = strcmp(argv[1], "--right-quotient") == 0;
+    equivalent_mode  = strcmp(argv[1], "--equivalent")   == 0;
+    compile_mode     = strcmp(argv[1], "--compile")      == 0;
+    load_mode        = strcmp(argv[1], "--load")         == 0;
+    scan_mode        = strcmp(argv[1], "--scan")         == 0;
+    count_mode       = strcmp(argv[1], "--count")        == 0;
+    cardinality_mode = strcmp(argv[1], "--cardinality")  == 0;
+    enumerate_mode   = strcmp(argv[1], "--enumerate")    == 0;
+    enumupto_mode    = strcmp(argv[1], "--enumerate-upto") == 0;
+    if (queries_mode) {
+        if (argc < 3 || !argv[2][0]) {
+            fprintf(stderr, "Error: --queries requires a list such as "
+                            "empty,has-epsilon,uses=a,starts-with=*\n");
+            return 1;
+        }
+        if (!parse_queries(argv[2])) return 1;
+    }
+    if (stripword_mode || rstripword_mode || lquot_mode || rquot_mode) {
+        if (argc < 3) {
+            fprintf(stderr, "Error: %s requires a %s argument\n", argv[1],
+                    (lquot_mode || rquot_mode) ? "regex" : "word");
+            return 1;
+        }
+        word_arg = argv[2];
+        word_len = strlen(argv[2]);
+    }
+    if ((compile_mode || load_mode) && argc < 3) {
+        fprintf(stderr, "Error: %s requires a file name\n", argv[1]);
+        return 1;
+    }
+    if (load_mode && !load_file(argv[2])) return 1;
+    if (count_mode || enumerate_mode || enumupto_mode) {
+        char* end = NULL;
+        errno = 0;
+        if (argc >= 3 && isdigit((unsigned char)argv[2][0]))
+            num_arg = strtoull(argv[2], &end, 10);
+        if (!end || *end || errno == ERANGE) {
+            fprintf(stderr, "Error: %s requires a %s\n", argv[1],
+                    enumerate_mode ? "number of strings" : "string length");
+            return 1;
+        }
+    }
+    int scan_fd = -1, corpus_fd = STDIN_FILENO;
+    if (scan_mode) {
+        scan_fd = argc < 3 ? -1 : open(argv[2], O_RDONLY);
+        if (scan_fd < 0) {
+            fprintf(stderr, "Error: --scan requires a readable file of patterns\n");
+            return 1;
+        }
+        if (argc > 3 && strncmp(argv[3], "--", 2) != 0
+            && (corpus_fd = open(argv[3], O_RDONLY)) < 0) {
+            fprintf(stderr, "Error: cannot read %s\n", argv[3]);
+            return 1;
+        }
+    }
+    if (match_mode) {
+        int fd = argc < 3 ? -1 : open(argv[2], O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Error: --match requires a readable file of strings\n");
+            return 1;
+        }
+        read_lines(fd, match_add);
+        close(fd);
+    }
+    if (uses_mode|| notusing_mode || startswith_mode || endswith_mode || strip_mode || insert_mode) {
+        if (argc<3 || strlen(argv[2])!=1) {
+            fprintf(stderr,"Error: %s requires one symbol argument\n",argv[1]);
+            return 1;
+        }
+        sym = argv[2][0];
+    }
+    int alloc_report = 0, njobs = 1, want_memo = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--alloc-stats") == 0) alloc_report = 1;
+        if (strcmp(argv[i], "--compact") == 0)     compact_mode = 1;
+        if (strcmp(argv[i], "--size-report") == 0) size_report = 1;
+        if (strcmp(argv[i], "--memo") == 0)        want_memo = 1;
+        if (strcmp(argv[i], "--stats") == 0)       stats_mode = STATS_TEXT;
+        if (strcmp(argv[i], "--stats=json") == 0)  stats_mode = STATS_JSON;
+        if (strncmp(argv[i], "--stats-file=", 13) == 0) {
+            stats_fd = open(argv[i] + 13, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (stats_fd < 0) {
+                fprintf(stderr, "Error: cannot write %s\n", argv[i] + 13);
+                return 1;
+            }
+        }
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (strcmp(argv[i] + 9, "dfa") == 0)           match_engine = ENGINE_DFA;
+            else if (strcmp(argv[i] + 9, "glushkov") == 0) match_engine = ENGINE_GLUSHKOV;
+            else {
+                fprintf(stderr, "Error: --engine must be dfa or glushkov\n");
+                return 1;
+            }
+        }
+        if (strncmp(argv[i], "--in=", 5) == 0 && !parse_format(argv[i] + 5, &in_format)) {
+            fprintf(stderr, "Error: --in must be infix, postfix or prefix\n");
+            return 1;
+        }
+        if (strncmp(argv[i], "--out=", 6) == 0 && !parse_format(argv[i] + 6, &out_format)) {
+            fprintf(stderr, "Error: --out must be infix, postfix or prefix\n");
+            return 1;
+        }
+        if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cache requires a directory\n");
+                return 1;
+            }
+            cache_dir = argv[++i];
+        }
+        if (strncmp(argv[i], "--cache-max=", 12) == 0) {
+            char* end = NULL;
+            unsigned long long mb = strtoull(argv[i] + 12, &end, 10);
+            if (!isdigit((unsigned char)argv[i][12]) || *end || mb == 0 || mb > (1ULL << 40)) {
+                fprintf(stderr, "Error: --cache-max requires a size in megabytes\n");
+                return 1;
+            }
+            cache_max = mb << 20;
+        }
+        if (strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 >= argc || !isdigit((unsigned char)argv[i + 1][0])) {
+                fprintf(stderr, "Error: --jobs requires a thread count (0 = all cores)\n");
+                return 1;
+            }
+            njobs = atoi(argv[++i]);
+            if (njobs <= 0) njobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            if (njobs <= 0) njobs = 1;
+        }
+    }
+
+    if (equivalent_mode) njobs = 1;     // a pair may straddle two chunks
+    if (compile_mode) njobs = 1;        // entries go to the file in input order
+    // Pairs, files and corpora are not one line in, one answer out, and
+    // --size-report has to see every result: no memo or cache for them.
+    if (equivalent_mode || compile_mode || load_mode || scan_mode || size_report)
+        cache_dir = NULL;
+    else
+        memo_on = want_memo;
+    if (memo_on) memo_share(njobs);
+    if (cache_dir) {
+        if (!cache_open()) return 1;
+        cache_mode_fp = cache_fingerprint(argc, argv);
+    }
+
+    OutBuf stdout_buf = { NULL, 0, 0, STDOUT_FILENO, 0 };
+    OutBuf stats_buf  = { NULL, 0, 0, stats_fd, 0 };
+    out = &stdout_buf;
+    stats_out = &stats_buf;
+    if (load_mode)       read_lines(STDIN_FILENO, load_line);
+    else if (scan_mode) {
+        scan_prepare(scan_fd);          // after --in is known
+        read_lines(corpus_fd, scan_line);
+    }
+    else if (njobs > 1)  run_jobs(njobs);
+    else                 read_lines(STDIN_FILENO, run_line);
+    out_flush(&stdout_buf);
+    if (equivalent_mode && eq_have_pending) {
+        fprintf(stderr, "Error: --equivalent takes regexes in pairs; the last one has no partner\n");
+        return 1;
+    }
+    if (cache_dir) cache_close();
+    if (compile_mode) compile_write(argv[2]);
+    if (stats_mode) {
+        stats_print(&stats_buf, 0, lines, &stats_total);
+        out_flush(&stats_buf);
+    }
+    if (alloc_report)
+        fprintf(stderr, "alloc: %lu calls, %lu bytes; %lu of %lu lines allocated\n",
+                alloc_calls, alloc_bytes, lines_allocating, lines);
+    if (size_report)
+        fprintf(stderr, "size: %s: %lu nodes in, %lu out (x%.2f), worst line x%.2f\n",
+                argv[1], size_in, size_out,
+                size_in ? (double)size_out / size_in : 0.0, size_worst);
     return 0;
 }
@@ -4,6 +4,10 @@ echo "no-op"
 (in2post|regex --no-op|pre2in) < input.txt > no-op.txt
 echo "simplify"
 (in2post|regex --simplify|pre2in) < input.txt > simplify.txt
+echo "simplify fixpoint"
+(in2post|regex --simplify|pre2in) < input-fixpoint.txt > simplify-fixpoint.txt
+echo "canonical"
+(in2post|regex --canonical|pre2in) < input.txt > canonical.txt
 echo "empty"
 (in2post|regex --empty) < input.txt > empty.txt
 echo "has-epsilon"
@@ -78,6 +82,8 @@ echo "insert e"
 (in2post|regex --insert e|pre2in) < input.txt > insert-e.txt
 echo "insert f"
 (in2post|regex --insert f|pre2in) < input.txt > insert-f.txt
+echo "insert a --compact"
+(in2post|regex --insert a --compact|pre2in) < input.txt > insert-a-compact.txt
 echo "strip a"
 (in2post|regex --strip a|pre2in) < input.txt > strip-a.txt
 echo "strip b"
@@ -90,7 +96,88 @@ echo "strip e"
 (in2post|regex --strip e|pre2in) < input.txt > strip-e.txt
 echo "strip f"
 (in2post|regex --strip f|pre2in) < input.txt > strip-f.txt
+echo "strip-word abac"
+(in2post|regex --strip-word abac|pre2in) < input.txt > strip-word-abac.txt
+echo "left-quotient a*b"
+(in2post|regex --left-quotient 'a*b.'|pre2in) < input.txt > left-quotient-astarb.txt
 
 # yes iff the regex matches "abac"
 echo "matches-abac"
 (in2post|regex --strip a|pre2in|in2post|regex --strip b|pre2in|in2post|regex --strip a|pre2in|in2post|regex --strip c|pre2in|in2post|regex --has-epsilon) < input.txt > matches-abac.txt
+
+# yes/no per string in match-strings.txt (the first is ε)
+echo "match"
+(in2post|regex --match match-strings.txt) < input.txt > match.txt
+echo "match --engine=glushkov"
+(in2post|regex --match match-strings.txt --engine=glushkov) < input.txt > match-glushkov.txt
+
+# compile every regex to one automaton file, then match from it:
+# one row per string, one column per regex
+echo "compile/load"
+(in2post|regex --compile input.dfa) < input.txt
+regex --load input.dfa < match-strings.txt > load.txt
+
+# consecutive lines taken as pairs: yes, or no and a shortest counterexample
+echo "equivalent"
+(in2post|regex --equivalent) < input.txt > equivalent.txt
+# an odd regex at the end has no partner: an error after the pairs
+echo "equivalent odd"
+(in2post|head -n 3|regex --equivalent 2>&1) < input.txt > equivalent-odd.txt
+
+# all boolean queries, one tab-separated row per regex
+echo "queries"
+(in2post|regex --queries 'empty,has-epsilon,has-nonepsilon,infinite,uses=*,starts-with=*,ends-with=*') < input.txt > queries.txt
+
+# concatenations with a side whose only string is ε; --queries must agree
+# with the single-answer modes
+echo "concat-eps"
+(in2post|regex --has-nonepsilon) < input-concat.txt > has-nonepsilon-concat.txt
+(in2post|regex --infinite) < input-concat.txt > infinite-concat.txt
+(in2post|regex --queries 'has-nonepsilon,infinite') < input-concat.txt > queries-concat.txt
+
+# per-line cost records for --simplify, timings dropped
+echo "stats"
+(in2post|regex --simplify --stats=json 2>&1 >/dev/null|sed 's/,"ns":[0-9]*//') < input.txt > stats-simplify.txt
+# with --memo the two repeated lines are answered without a parse
+(in2post|regex --simplify --memo --stats=json 2>&1 >/dev/null|sed 's/,"ns":[0-9]*//') < input.txt > stats-simplify-memo.txt
+
+# --simplify twice through one cache directory: the second run answers
+# from the cache and must print exactly what simplify.txt holds
+echo "cache"
+rm -rf input.cache
+(in2post|regex --simplify --cache input.cache) < input.txt > /dev/null
+(in2post|regex --simplify --cache input.cache|pre2in) < input.txt > cache-simplify.txt
+
+# The quotient's regex is read under --in too: 'a*b' in infix is not
+# 'a*b' in postfix (no regex, so every quotient is /), but is 'a*b.'
+echo "cache --in"
+rm -rf input.cache
+(regex --left-quotient 'a*b' --in=infix --cache input.cache) < input.txt > /dev/null
+(in2post|regex --left-quotient 'a*b' --cache input.cache|pre2in) < input.txt > left-quotient-cache.txt
+(in2post|regex --left-quotient 'a*b.' --cache input.cache|pre2in) < input.txt > left-quotient-astarb-cache.txt
+
+# all regexes against each string in one pass: ids (line numbers) of the
+# regexes that match, one row per string
+echo "scan"
+(in2post|regex --scan /dev/stdin match-strings.txt) < input.txt > scan.txt
+
+# number of strings of length 3 in each language, and its size
+echo "count 3"
+(in2post|regex --count 3) < input.txt > count-3.txt
+echo "cardinality"
+(in2post|regex --cardinality) < input.txt > cardinality.txt
+
+# the first strings of each language in shortlex order, as rank<TAB>string;
+# an empty line ends each list
+echo "enumerate 5"
+(in2post|regex --enumerate 5) < input.txt > enumerate-5.txt
+
+# live and dead symbol masks (hex, bit 0..9 = 0..9, 10..35 = a..z)
+echo "alphabet"
+(in2post|regex --alphabet) < input.txt > alphabet.txt
+
+# every symbol some string starts (ends) with, "/" for none
+echo "starts-with-set"
+(in2post|regex --starts-with-set) < input.txt > starts-with-set.txt
+echo "ends-with-set"
+(in2post|regex --ends-with-set) < input.txt > ends-with-set.txt